@@ -0,0 +1,220 @@
+#pragma once
+#include "pch.hpp"
+#include "MIDI/SMF.hpp"
+#include "Chord.hpp"
+#include "Tonality.hpp"
+#include "Smoothing.hpp"
+// Offline chord timelines of Standard MIDI Files
+//   Keyboard --analyze [--threads N] [--window MS] [--sounding] <file or directory>...
+// One CSV row per chord change per track and channel, with the running key and the smoothed chord, goes to stdout.
+// Channels are numbered 1-16 and GM percussion on channel 10 is skipped. Throughput goes to stderr.
+namespace analysis {
+	using namespace std;
+	const char* SMF_EXTENSIONS[] = { ".mid", ".midi", ".smf" };
+	const char* CSV_HEADER = "file,track,channel,tick,seconds,bass,chords,scales,key,smoothed\n";
+	constexpr uint8_t PERCUSSION_CHANNEL = 9; // Unpitched in General MIDI
+	// Runs func(index) for every index in [0, count). Workers pull indices from a shared counter,
+	// so uneven jobs balance themselves.
+	template<typename Func> void parallel_for(size_t count, size_t threads, Func&& func) {
+		atomic<size_t> next = 0;
+		auto worker = [&] {
+			for (size_t index; (index = next.fetch_add(1, memory_order_relaxed)) < count;) func(index);
+			};
+		vector<jthread> pool;
+		for (size_t i = 1; i < min(threads, count); i++) pool.emplace_back(worker);
+		worker();
+	}
+	// Quotes are doubled, the caller adds the enclosing ones
+	inline void append_csv_escaped(string& out, string_view field) {
+		for (char c : field) {
+			if (c == '"') out += '"';
+			out += c;
+		}
+	}
+	struct file_job {
+		string name;
+		mapped_file image;
+		midi::smf_file smf;
+	};
+	struct options_t {
+		size_t threads = max(1u, thread::hardware_concurrency());
+		uint64_t window = 0; // Arpeggio window in ns, 0 for none
+		bool sounding = false; // Keys kept sounding by the sustain and sostenuto pedals count as well
+	};
+	struct track_job {
+		size_t file, track;
+		size_t events = 0;
+		string csv;
+	};
+	// Everything analysed for one channel of a track
+	struct channel_job {
+		chord::midi_key_states_t keys;
+		chord::onset_window_t onsets;
+		chord::sounding_keys_t sounding;
+		array<uint8_t, chord::midi_key_states_t::NOTE_COUNT> held{}; // Note-ons per note
+		chord::format_key_t emitted{};
+		tonality::histogram_t pitches;
+		smoothing::decoder_t decoder;
+		// Rows wait here until their smoothed label leaves the decoder's window
+		array<string, smoothing::LAG> pending;
+		size_t pending_first = 0, pending_count = 0;
+		string csv;
+		inline void commit(uint8_t state) {
+			char label[16];
+			smoothing::format_state(label, sizeof(label), state);
+			csv += pending[pending_first], csv += ',', csv += label, csv += '\n';
+			pending_first = (pending_first + 1) % smoothing::LAG, pending_count--;
+		}
+	};
+	// Replays the track's notes into the chord engine, one state per channel. Returns the number of events read.
+	inline size_t analyze_track(file_job const& file, size_t track, options_t const& options, string& out) {
+		auto const& tempo_map = file.smf.tempo_map(track);
+		const uint64_t window = options.window;
+		vector<channel_job> channels(midi::MAX_CHANNEL_COUNT);
+		uint32_t active = 0; // Channels with any note so far
+		uint64_t tick = 0, time = 0;
+		auto flush = [&](size_t channel_index) {
+			auto& channel = channels[channel_index];
+			if (window) channel.onsets.expire(time, window);
+			chord::midi_key_states_t analysed = options.sounding ? channel.sounding.keys : channel.keys;
+			if (window) analysed.merge(channel.onsets.keys);
+			auto key = chord::format_key(analysed);
+			if (key == channel.emitted) return;
+			channel.emitted = key;
+			auto result = chord::analyze(analysed);
+			string& row = channel.pending[(channel.pending_first + channel.pending_count++) % smoothing::LAG];
+			char field[64];
+			row.clear();
+			row += '"', append_csv_escaped(row, file.name), row += '"';
+			snprintf(field, sizeof(field), ",%zu,%zu,%llu,%.6f,%s,", track, channel_index + 1, (unsigned long long)tick, time / 1e9, result.count ? chord::key_table[result.bass] : "");
+			row += field;
+			auto append_names = [&](auto&& for_each) {
+				row += '"';
+				bool first = true;
+				for_each(result, [&](string_view name) {
+					if (!first) row += " | ";
+					append_csv_escaped(row, name);
+					first = false;
+				});
+				row += '"';
+			};
+			append_names([](auto const& result, auto&& func) { chord::for_each_chord_name(result, func); });
+			row += ',';
+			append_names([](auto const& result, auto&& func) { chord::for_each_scale_name(result, func); });
+			auto estimate = tonality::estimate(channel.pitches, time);
+			if (estimate.key >= 0) snprintf(field, sizeof(field), ",%s %s", chord::key_table[estimate.tonic()], estimate.mode());
+			else snprintf(field, sizeof(field), ",");
+			row += field;
+			const int state = channel.decoder.step(analysed.pitch_classes());
+			if (state >= 0) channel.commit(state);
+			};
+		auto flush_all = [&] {
+			for (uint32_t mask = active; mask; mask &= mask - 1) flush(countr_zero(mask));
+			};
+		size_t events = 0;
+		midi::smf_track_reader reader(file.smf.tracks[track]);
+		for (midi::smf_event event; reader.next(event); events++) {
+			// Everything on one tick lands as a single change
+			if (event.tick != tick) flush_all(), tick = event.tick, time = tempo_map.to_ns(tick);
+			if (!event.isChannel()) continue;
+			auto message = event.message();
+			if (message.channel() == PERCUSSION_CHANNEL) continue;
+			auto& channel = channels[message.channel()];
+			auto release = [&](uint8_t note) {
+				note &= chord::midi_key_states_t::NOTE_COUNT - 1;
+				if (channel.held[note] && !--channel.held[note]) channel.keys.set(note, 0), channel.sounding.note(note, 0), channel.pitches.note(note, false, time);
+				};
+			midi::dispatch(message, visitor{
+				[&](midi::noteOnMessage& msg) {
+					if (!msg.velocity) return release(msg.note);
+					const uint8_t note = msg.note & (chord::midi_key_states_t::NOTE_COUNT - 1);
+					active |= 1u << msg.channel;
+					if (!channel.held[note]) channel.pitches.note(note, true, time);
+					if (channel.held[note] < UINT8_MAX) channel.held[note]++;
+					channel.keys.set(note, msg.velocity);
+					channel.sounding.note(note, msg.velocity);
+					if (window) channel.onsets.add(note, msg.velocity, time, window);
+				},
+				[&](midi::noteOffMessage& msg) {
+					release(msg.note);
+				},
+				[&](midi::controlChangeMessage& msg) {
+					channel.sounding.control(msg.controller, msg.value, channel.keys);
+				}
+				});
+		}
+		flush_all();
+		// Rows go out channel by channel, each channel in tick order
+		for (auto& channel : channels) {
+			array<uint8_t, smoothing::LAG> path;
+			const size_t length = channel.decoder.window(path);
+			for (size_t i = length - channel.pending_count; i < length; i++) channel.commit(path[i]);
+			out += channel.csv;
+		}
+		return events;
+	}
+	inline void collect(filesystem::path const& path, vector<filesystem::path>& paths) {
+		error_code ec;
+		if (!filesystem::is_directory(path, ec)) {
+			paths.push_back(path);
+			return;
+		}
+		for (auto it = filesystem::recursive_directory_iterator(path, filesystem::directory_options::skip_permission_denied, ec); !ec && it != filesystem::recursive_directory_iterator(); it.increment(ec)) {
+			if (!it->is_regular_file(ec)) continue;
+			string extension = it->path().extension().string();
+			for (auto& c : extension) c = tolower(c);
+			for (auto ext : SMF_EXTENSIONS)
+				if (extension == ext) {
+					paths.push_back(it->path());
+					break;
+				}
+		}
+	}
+	inline int run(int argc, char** argv) {
+		options_t options;
+		vector<filesystem::path> paths;
+		for (int i = 0; i < argc; i++) {
+			if (!strcmp(argv[i], "--threads") && i + 1 < argc) options.threads = max(1, atoi(argv[++i]));
+			else if (!strcmp(argv[i], "--window") && i + 1 < argc) options.window = midi::clock::from_ms(max(0, atoi(argv[++i])));
+			else if (!strcmp(argv[i], "--sounding")) options.sounding = true;
+			else collect(argv[i], paths);
+		}
+		if (paths.empty()) {
+			fprintf(stderr, "usage: --analyze [--threads N] [--window MS] [--sounding] <file or directory>...\n");
+			return 1;
+		}
+		sort(paths.begin(), paths.end());
+		auto start = chrono::steady_clock::now();
+		// Map and index every file, then analyse every track of every file
+		vector<file_job> files(paths.size());
+		atomic<size_t> skipped = 0;
+		parallel_for(files.size(), options.threads, [&](size_t i) {
+			auto& file = files[i];
+			file.name = paths[i].string();
+			file.image = mapped_file(paths[i]);
+			if (file.image.empty() || !file.smf.parse(file.image.span())) {
+				file.smf.tracks.clear();
+				skipped++;
+			}
+			});
+		vector<track_job> tracks;
+		for (size_t i = 0; i < files.size(); i++)
+			for (size_t j = 0; j < files[i].smf.tracks.size(); j++)
+				tracks.push_back({ i, j });
+		parallel_for(tracks.size(), options.threads, [&](size_t i) {
+			tracks[i].events = analyze_track(files[tracks[i].file], tracks[i].track, options, tracks[i].csv);
+			});
+		const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		fputs(CSV_HEADER, stdout);
+		size_t events = 0;
+		for (auto& track : tracks) {
+			fwrite(track.csv.data(), 1, track.csv.size(), stdout);
+			events += track.events;
+		}
+		fflush(stdout);
+		const double rate = events / max(seconds, 1e-9);
+		fprintf(stderr, "%zu files (%zu skipped), %zu tracks, %zu events in %.3fs on %zu threads\n", files.size(), skipped.load(), tracks.size(), events, seconds, options.threads);
+		fprintf(stderr, "%.0f events/s, %.0f events/s per core\n", rate, rate / options.threads);
+		return 0;
+	}
+}
@@ -1,3 +1,4 @@
+#pragma once
 namespace chord {
 	using namespace std;
 	typedef array<uint8_t, 12> key_t;
@@ -13,16 +14,16 @@ namespace chord {
 		const fmt_type fmt = NONE;
 		const char* fmt_str = nullptr;
 		const uint8_t nth_root = 0;
-		int format_to_string(char* str, const char* bass_key, const char* nth_key) const {			
+		int format_to_string(char* str, size_t size, const char* bass_key, const char* nth_key) const {
 			switch (fmt) {
-				case BASS: return sprintf(str, fmt_str, bass_key);
-				case BASS_BASS: return sprintf(str, fmt_str, bass_key, bass_key);
-				case BASS_ROOT_BASS: return sprintf(str, fmt_str, bass_key, nth_key, bass_key);
-				case ROOT: return sprintf(str, fmt_str, nth_key);
-				case ROOT_BASS: return sprintf(str, fmt_str, nth_key, bass_key);
+				case BASS: return snprintf(str, size, fmt_str, bass_key);
+				case BASS_BASS: return snprintf(str, size, fmt_str, bass_key, bass_key);
+				case BASS_ROOT_BASS: return snprintf(str, size, fmt_str, bass_key, nth_key, bass_key);
+				case ROOT: return snprintf(str, size, fmt_str, nth_key);
+				case ROOT_BASS: return snprintf(str, size, fmt_str, nth_key, bass_key);
 				case NONE:
 				default:
-					return sprintf(str, "%s", fmt_str);
+					return snprintf(str, size, "%s", fmt_str);
 			}
 		}
 	};
@@ -32,15 +33,15 @@ namespace chord {
 		const size_t num_chords;
 	public:
 		template<typename... T> constexpr explicit chord_arr_t(T... args) : chords{ args... }, num_chords(sizeof...(args)) {}
-		container_type::const_iterator begin() const { return chords.begin(); }
-		container_type::const_iterator end() const { return chords.begin() + num_chords; }
-		size_t size() const { return num_chords; }
+		constexpr container_type::const_iterator begin() const { return chords.begin(); }
+		constexpr container_type::const_iterator end() const { return chords.begin() + num_chords; }
+		constexpr size_t size() const { return num_chords; }
 	};
 	/****/
 	typedef pair<key_t, chord_arr_t> chord_item_t;
 	const char* key_table[] = { "C" ,"Db","D","Eb","E","F","Gb","G","Ab","A","Bb","B" };
 	const char* interval_table[] = { "Oct","min 2nd","Maj 2nd","min 3rd","Maj 3rd","Perfect 4th","Tritone","Perfect 5th","min 6th","Maj 6th","min 7th","Maj 7th" };
-	const chord_item_t chord_table[] = {
+	constexpr chord_item_t chord_table[] = {
 			{{1, 3, 4}, chord_arr_t{chord_t{ chord_t::ROOT_BASS,"%smMaj9/ %s", 0},}},
 			{{1, 3, 4, 6}, chord_arr_t{chord_t{ chord_t::ROOT_BASS,"%smM11(no5)/ %s", 0},}},
 			{{1, 3, 4, 6, 7}, chord_arr_t{chord_t{ chord_t::ROOT_BASS,"%s13(#9b9)/ %s", 1},}},
@@ -482,7 +483,7 @@ namespace chord {
 			{{8, 10}, chord_arr_t{chord_t{ chord_t::ROOT_BASS,"%sadd9/ %s", 0},}},
 			{{9, 11}, chord_arr_t{chord_t{ chord_t::ROOT_BASS,"%sm(add9)/ %s", 0},}}
 		};
-	const chord_item_t scale_table[] = {
+	constexpr chord_item_t scale_table[] = {
 			{{1, 3, 4, 6, 7, 9, 10}, chord_arr_t{chord_t{ chord_t::BASS,"%s Diminished", 0},chord_t{ chord_t::NONE,"Half - Whole", 0},}},
 			{{1, 3, 4, 6, 8, 10}, chord_arr_t{chord_t{ chord_t::BASS,"%s Altered", 0},chord_t{ chord_t::NONE,"Super Locrian", 0},}},
 			{{1, 3, 5, 6, 8, 10}, chord_arr_t{chord_t{ chord_t::BASS,"%s Locrian", 0},}},
@@ -513,57 +514,488 @@ namespace chord {
 		};
 }
 namespace chord {
-	typedef array<uint8_t, 256> midi_key_states_t;
-	const chord_item_t* find(key_t const& key, const chord_item_t* data, size_t size) {
-		auto itm = chord_item_t{ key, chord_arr_t{} };
-		auto it = lower_bound(data, data + size, key, [](chord_item_t const& lhs, key_t const& key) {return lhs.first < key; });
-		if (it && it->first == key) return it;
-		return nullptr;
+	// Pitch class sets are 12-bit masks, bit n set = n semitones above C (or above the bass, for intervals)
+	typedef uint16_t pitch_class_mask_t;
+	constexpr pitch_class_mask_t PITCH_CLASS_MASK_ALL = 0xFFF;
+	constexpr pitch_class_mask_t rotate_pitch_classes(pitch_class_mask_t mask, int n) {
+		n %= 12;
+		return ((mask >> n) | (mask << (12 - n))) & PITCH_CLASS_MASK_ALL;
 	}
-	template<typename T> const int format(midi_key_states_t const& state, span<T>&& lines) {
-		static vector<uint8_t> keys(256), crange(256);		
-		keys.clear(); for (int i = 0;i < 256;i++) if (state[i]) keys.push_back(i);
-		if (!keys.size()) return 0;
-		// push keys into the same octave & sorted
-		// match keys after the root note
-		crange.clear(); for (int i = 0;i < keys.size() - 1;i++) crange.push_back((keys[i + 1] - keys[0]) % 12);
-		sort(crange.begin(), crange.end());		
-		crange.resize(unique(crange.begin(), crange.end()) - crange.begin());
-		static key_t chord_keys; fill(chord_keys.begin(), chord_keys.end(), 0);		
-		copy(crange.begin() + (crange.size() > 1 && crange[0] == 0), crange.end(), chord_keys.begin());
-		// find chord & scale (if applicable)
-		uint8_t bass_k = keys[0] % 12;
-		auto chord_v = find(chord_keys, chord_table, extent_of(chord_table));
-		auto scale_v = find(chord_keys, scale_table, extent_of(scale_table));
-		auto line_it = lines.begin();
-		// chords
-		if (chord_v) {
-			for (auto& v : chord_v->second) {
-				uint8_t nth_k = (keys[0] + chord_keys[v.nth_root]) % 12;
-				v.format_to_string(line_it->data(), key_table[bass_k], key_table[nth_k]);
-				line_it++;
+	// 128-bit active note mask alongside the velocities. Queries are bit operations on the mask.
+	struct midi_key_states_t {
+		static constexpr int NOTE_COUNT = 128;
+		array<uint64_t, 2> mask{};
+		array<uint8_t, NOTE_COUNT> velocity{};
+
+		inline uint8_t operator[](size_t note) const { return velocity[note & (NOTE_COUNT - 1)]; }
+		inline void set(uint8_t note, uint8_t vel) {
+			note &= NOTE_COUNT - 1;
+			velocity[note] = vel;
+			const uint64_t bit = 1ull << (note & 63);
+			if (vel) mask[note >> 6] |= bit;
+			else mask[note >> 6] &= ~bit;
+		}
+		inline bool empty() const { return !(mask[0] | mask[1]); }
+		inline int count() const { return popcount(mask[0]) + popcount(mask[1]); }
+		// -1 if empty
+		inline int lowest() const {
+			if (mask[0]) return countr_zero(mask[0]);
+			if (mask[1]) return 64 + countr_zero(mask[1]);
+			return -1;
+		}
+		// Union of held notes, keeping the louder velocity
+		inline void merge(midi_key_states_t const& other) {
+			for (int word = 0; word < 2; word++) mask[word] |= other.mask[word];
+			for (int note = 0; note < NOTE_COUNT; note++) velocity[note] = max(velocity[note], other.velocity[note]);
+		}
+		// Calls func(note) for every held note in ascending order
+		template<typename Func> inline void for_each(Func&& func) const {
+			for (int word = 0; word < 2; word++)
+				for (uint64_t m = mask[word]; m; m &= m - 1)
+					func(word * 64 + countr_zero(m));
+		}
+		// Folds held notes into a pitch class set. skip_lowest leaves the bass note itself out.
+		inline pitch_class_mask_t pitch_classes(bool skip_lowest = false) const {
+			pitch_class_mask_t pcs = 0;
+			array<uint64_t, 2> m = mask;
+			if (skip_lowest) {
+				if (m[0]) m[0] &= m[0] - 1;
+				else m[1] &= m[1] - 1;
 			}
+			// Notes 0-63 start on a C; notes 64-71 are E-B, then 72 starts on a C again
+			for (int i = 0; i < 64; i += 12) pcs |= pitch_class_mask_t(m[0] >> i);
+			pcs |= pitch_class_mask_t((m[1] & 0xFF) << 4);
+			for (int i = 8; i < 64; i += 12) pcs |= pitch_class_mask_t(m[1] >> i);
+			return pcs & PITCH_CLASS_MASK_ALL;
 		}
-		// intervals
-		if (crange.size() && crange.size() < 3 && keys.size() > 1) {
-			if (crange.size() == 1)
-				sprintf(line_it->data(), "%s %s", key_table[bass_k],interval_table[crange[0]]), line_it++;
-			else
-				sprintf(line_it->data(), "%s %s", key_table[bass_k],interval_table[crange[1]]), line_it++;
+		// Pitch classes of every note above the bass, relative to the bass. Bit 0 set = the bass is doubled.
+		inline pitch_class_mask_t intervals() const {
+			const int bass = lowest();
+			return bass < 0 ? 0 : rotate_pitch_classes(pitch_classes(true), bass % 12);
 		}
-		// scales
-		if (scale_v && keys.size() > 1) {
-			for (auto& v : scale_v->second) {
-				uint8_t nth_k = (keys[0] + chord_keys[v.nth_root]) % 12;
-				v.format_to_string(line_it->data(), key_table[bass_k], key_table[nth_k]);
-				line_it++;
+	};
+	// Notes struck within the last `duration` nanoseconds, released or not, so arpeggiated and rolled
+	// chords are named as a whole. Onsets are kept oldest first and only expired when an onset arrives
+	// or the owner asks, each leaving once: O(1) amortized per note.
+	struct onset_window_t {
+		static constexpr size_t CAPACITY = 32; // The oldest onset leaves early past this many
+		struct onset_t {
+			uint64_t time;
+			uint8_t note;
+		};
+		array<onset_t, CAPACITY> ring{};
+		uint32_t first = 0, count = 0;
+		array<uint8_t, midi_key_states_t::NOTE_COUNT> onsets{}; // Per note, in the ring
+		midi_key_states_t keys{};
+		inline void pop() {
+			const uint8_t note = ring[first].note;
+			if (!--onsets[note]) keys.set(note, 0);
+			first = (first + 1) % CAPACITY, count--;
+		}
+		// Drops onsets from before time - duration. Returns whether any were dropped.
+		inline bool expire(uint64_t time, uint64_t duration) {
+			const uint32_t before = count;
+			while (count && ring[first].time + duration < time) pop();
+			return count != before;
+		}
+		inline void add(uint8_t note, uint8_t velocity, uint64_t time, uint64_t duration) {
+			note &= midi_key_states_t::NOTE_COUNT - 1;
+			expire(time, duration);
+			if (count == CAPACITY) pop();
+			ring[(first + count++) % CAPACITY] = { time, note };
+			onsets[note]++;
+			keys.set(note, max(keys[note], velocity));
+		}
+	};
+	// Held keys plus those the sustain (CC64) or sostenuto (CC66) pedal keeps sounding after their note off.
+	// Sostenuto only latches the keys held when it went down. Updated per note and pedal event.
+	struct sounding_keys_t {
+		static constexpr uint8_t SUSTAIN = 64, SOSTENUTO = 66;
+		midi_key_states_t keys{};
+		array<uint64_t, 2> sostenuto{}; // Held when the sostenuto pedal went down, empty while it is up
+		bool sustain = false, sostenuto_down = false;
+		inline bool latched(uint8_t note) const { return sustain || (sostenuto[note >> 6] >> (note & 63) & 1); }
+		inline void note(uint8_t note, uint8_t velocity) {
+			note &= midi_key_states_t::NOTE_COUNT - 1;
+			if (velocity || !latched(note)) keys.set(note, velocity);
+		}
+		// held is the channel's held keys after the event
+		inline void control(uint8_t controller, uint8_t value, midi_key_states_t const& held) {
+			const bool down = value >= 64;
+			if (controller == SUSTAIN) sustain = down;
+			else if (controller == SOSTENUTO) {
+				// Pedals stream values, only the press itself captures
+				if (down == sostenuto_down) return;
+				sostenuto_down = down;
+				sostenuto = down ? held.mask : array<uint64_t, 2>{};
 			}
+			else return;
+			if (down || sustain) return;
+			// Pedal up, release whatever only it kept sounding
+			for (int word = 0; word < 2; word++)
+				for (uint64_t m = keys.mask[word] & ~(held.mask[word] | sostenuto[word]); m; m &= m - 1)
+					keys.set(word * 64 + countr_zero(m), 0);
+		}
+	};
+	/****/
+	// Table keys are ascending intervals above the bass, zero padded. Bit 0 (the octave) never takes part.
+	constexpr pitch_class_mask_t LOOKUP_MASK = PITCH_CLASS_MASK_ALL & ~1;
+	constexpr pitch_class_mask_t key_to_mask(key_t const& key) {
+		pitch_class_mask_t mask = 0;
+		for (auto k : key) if (k) mask |= 1 << k;
+		return mask;
+	}
+	// Interval mask -> dictionary entry index, -1 if absent
+	typedef array<int16_t, PITCH_CLASS_MASK_ALL + 1> lookup_table_t;
+	// Every built-in entry needs a mask of its own, or the built-in dictionary fails validation at startup
+	template<size_t Size> consteval bool masks_unique(const chord_item_t(&table)[Size]) {
+		array<bool, PITCH_CLASS_MASK_ALL + 1> seen{};
+		for (auto& item : table) {
+			const pitch_class_mask_t mask = key_to_mask(item.first);
+			if ((mask & ~LOOKUP_MASK) || seen[mask]) return false;
+			seen[mask] = true;
+		}
+		return true;
+	}
+	static_assert(masks_unique(chord_table) && masks_unique(scale_table), "Built-in chord tables have entries sharing a mask");
+	// Everything format() output depends on. Equal keys format to equal lines.
+	struct format_key_t {
+		pitch_class_mask_t intervals = 0;
+		uint8_t bass = 0; // Pitch class
+		uint8_t count = 0; // 0, 1 or 2 for two or more keys
+		bool operator==(format_key_t const&) const = default;
+	};
+	inline format_key_t format_key(midi_key_states_t const& state) {
+		if (state.empty()) return {};
+		return { state.intervals(), uint8_t(state.lowest() % 12), uint8_t(min(state.count(), 2)) };
+	}
+	/****/
+	// Chord and scale names. The built-in tables and dictionary files share one binary image, files are mapped and used in place.
+	// Little endian, every section 4-byte aligned:
+	//   header | entries (chords, then scales, each ascending by mask) | names | string pool
+	// Name formats are printf strings taking exactly the %s arguments their chord_t::fmt_type passes.
+	constexpr char DICTIONARY_MAGIC[4] = { 'K', 'B', 'D', 'C' };
+	constexpr uint32_t DICTIONARY_VERSION = 1;
+	constexpr size_t MAX_DICTIONARY_ENTRIES = 2048; // Per section, fuzzy_find packs indices into 11 bits
+	struct dictionary_header_t {
+		char magic[4];
+		uint32_t version;
+		uint32_t chord_count, scale_count, name_count, pool_size;
+	};
+	struct dictionary_entry_t {
+		pitch_class_mask_t mask; // Intervals above the bass, bit 0 clear
+		uint16_t name_count;
+		uint32_t first_name;
+	};
+	struct dictionary_name_t {
+		uint8_t fmt; // chord_t::fmt_type
+		uint8_t nth_root; // The root is the nth interval of the mask, or the bass past the last one
+		uint16_t reserved;
+		uint32_t offset; // Null terminated format string in the pool
+	};
+	static_assert(sizeof(dictionary_header_t) == 24 && sizeof(dictionary_entry_t) == 8 && sizeof(dictionary_name_t) == 8);
+	// Same as indexing a zero padded key_t
+	constexpr uint8_t nth_interval(pitch_class_mask_t mask, int n) {
+		for (; n > 0 && mask; n--) mask &= mask - 1;
+		return mask ? countr_zero(mask) : 0;
+	}
+	class dictionary_t {
+		vector<char> _image; // The built-in tables, files stay mapped instead
+		mapped_file _file;
+		span<const dictionary_entry_t> _chords, _scales;
+		span<const dictionary_name_t> _names;
+		const char* _pool = nullptr;
+		lookup_table_t _chord_lookup, _scale_lookup;
+		vector<pitch_class_mask_t> _chord_masks; // Packed for fuzzy_find
+
+		static bool valid_format(const char* fmt, uint8_t type) {
+			constexpr int ARGUMENTS[] = { 1, 2, 3, 1, 2 };
+			if (type == chord_t::NONE) return true; // Printed as is
+			int arguments = 0;
+			for (const char* p = fmt; *p; p++) {
+				if (*p != '%') continue;
+				if (p[1] == 's') arguments++;
+				else if (p[1] != '%') return false;
+				p++;
+			}
+			return arguments == ARGUMENTS[type];
+		}
+		// Validates the image and points the views into it. Nothing is copied.
+		bool attach(span<const char> image) {
+			dictionary_header_t header;
+			if (image.size() < sizeof(header)) return false;
+			memcpy(&header, image.data(), sizeof(header));
+			if (memcmp(header.magic, DICTIONARY_MAGIC, 4) || header.version != DICTIONARY_VERSION) return false;
+			if (header.chord_count > MAX_DICTIONARY_ENTRIES || header.scale_count > MAX_DICTIONARY_ENTRIES) return false;
+			// 64-bit so the counts cannot wrap the offsets on 32-bit targets
+			const uint64_t names_offset = sizeof(header) + (uint64_t(header.chord_count) + header.scale_count) * sizeof(dictionary_entry_t);
+			const uint64_t pool_offset = names_offset + uint64_t(header.name_count) * sizeof(dictionary_name_t);
+			if (pool_offset + header.pool_size > image.size() || !header.pool_size || image[size_t(pool_offset + header.pool_size - 1)]) return false;
+			auto entries = (const dictionary_entry_t*)(image.data() + sizeof(header));
+			_chords = { entries, header.chord_count };
+			_scales = { entries + header.chord_count, header.scale_count };
+			_names = { (const dictionary_name_t*)(image.data() + size_t(names_offset)), header.name_count };
+			_pool = image.data() + size_t(pool_offset);
+			// Name ranges must tile _names in entry order, name_table_t numbers names by walking them
+			uint64_t next_name = 0;
+			for (auto section : { _chords, _scales }) {
+				for (size_t i = 0; i < section.size(); i++) {
+					auto const& entry = section[i];
+					if ((entry.mask & ~LOOKUP_MASK) || (i && entry.mask <= section[i - 1].mask)) return false;
+					if (!entry.name_count || entry.first_name != next_name) return false;
+					next_name += entry.name_count;
+				}
+			}
+			if (next_name != _names.size()) return false;
+			for (auto const& name : _names)
+				if (name.fmt > chord_t::NONE || name.nth_root >= 12 || name.offset >= header.pool_size || !valid_format(_pool + name.offset, name.fmt)) return false;
+			_chord_lookup.fill(-1), _scale_lookup.fill(-1);
+			for (size_t i = 0; i < _chords.size(); i++) _chord_lookup[_chords[i].mask] = _chord_lookup[_chords[i].mask | 1] = (int16_t)i;
+			for (size_t i = 0; i < _scales.size(); i++) _scale_lookup[_scales[i].mask] = _scale_lookup[_scales[i].mask | 1] = (int16_t)i;
+			_chord_masks.clear();
+			for (auto const& entry : _chords) _chord_masks.push_back(entry.mask);
+			return true;
+		}
+	public:
+		dictionary_t() = default;
+		dictionary_t(dictionary_t&&) = default;
+		dictionary_t& operator=(dictionary_t&&) = default;
+		dictionary_t(dictionary_t const&) = delete;
+		// chord_table and scale_table in the file format
+		static vector<char> serialize_builtin() {
+			vector<dictionary_entry_t> entries;
+			vector<dictionary_name_t> names;
+			string pool;
+			auto add = [&](chord_item_t const& item) {
+				entries.push_back({ key_to_mask(item.first), (uint16_t)item.second.size(), (uint32_t)names.size() });
+				for (auto& v : item.second) {
+					names.push_back({ (uint8_t)v.fmt, v.nth_root, 0, (uint32_t)pool.size() });
+					pool.append(v.fmt_str).push_back(0);
+				}
+			};
+			// The tables are sorted by key, sections are sorted by mask
+			auto add_section = [&](span<const chord_item_t> table) {
+				vector<const chord_item_t*> items;
+				for (auto& item : table) items.push_back(&item);
+				sort(items.begin(), items.end(), [](auto lhs, auto rhs) { return key_to_mask(lhs->first) < key_to_mask(rhs->first); });
+				for (auto item : items) add(*item);
+			};
+			add_section(chord_table);
+			add_section(scale_table);
+			while (pool.size() % 4) pool.push_back(0);
+			dictionary_header_t header{ .version = DICTIONARY_VERSION, .chord_count = extent_of(chord_table), .scale_count = extent_of(scale_table), .name_count = (uint32_t)names.size(), .pool_size = (uint32_t)pool.size() };
+			memcpy(header.magic, DICTIONARY_MAGIC, 4);
+			vector<char> image;
+			auto append = [&](const void* data, size_t size) { image.insert(image.end(), (const char*)data, (const char*)data + size); };
+			append(&header, sizeof(header));
+			append(entries.data(), entries.size() * sizeof(dictionary_entry_t));
+			append(names.data(), names.size() * sizeof(dictionary_name_t));
+			append(pool.data(), pool.size());
+			return image;
+		}
+		static dictionary_t builtin() {
+			dictionary_t dictionary;
+			dictionary._image = serialize_builtin();
+			ASSERT(dictionary.attach({ dictionary._image.data(), dictionary._image.size() }), L"Built-in chord dictionary is invalid");
+			return dictionary;
 		}
+		// False if the file is missing or invalid
+		bool load(filesystem::path const& path) {
+			_file = mapped_file(path);
+			return !_file.empty() && attach(_file.span());
+		}
+		inline span<const dictionary_entry_t> chords() const { return _chords; }
+		inline span<const dictionary_entry_t> scales() const { return _scales; }
+		inline span<const dictionary_name_t> names() const { return _names; }
+		inline span<const pitch_class_mask_t> chord_masks() const { return _chord_masks; }
+		inline int16_t find_chord(pitch_class_mask_t intervals) const { return _chord_lookup[intervals & PITCH_CLASS_MASK_ALL]; }
+		inline int16_t find_scale(pitch_class_mask_t intervals) const { return _scale_lookup[intervals & PITCH_CLASS_MASK_ALL]; }
+		// Formats a name over a bass pitch class, the root follows from the entry's intervals
+		inline int format_name(char* str, size_t size, dictionary_entry_t const& entry, dictionary_name_t const& name, uint8_t bass) const {
+			const chord_t chord{ (chord_t::fmt_type)name.fmt, _pool + name.offset, name.nth_root };
+			return chord.format_to_string(str, size, key_table[bass], key_table[(bass + nth_interval(entry.mask, name.nth_root)) % 12]);
+		}
+	};
+	inline dictionary_t& active_dictionary() {
+		static dictionary_t dictionary = dictionary_t::builtin();
+		return dictionary;
+	}
+	inline dictionary_t const& dictionary() { return active_dictionary(); }
+	// Call before the first analysis, names are interned from the dictionary only once. Keeps the current one on failure.
+	inline bool load_dictionary(filesystem::path const& path) {
+		dictionary_t loaded;
+		if (!loaded.load(path)) return false;
+		active_dictionary() = std::move(loaded);
+		return true;
+	}
+	/****/
+	// Result of analyze(). Plain data, owned by the caller.
+	struct analysis_t {
+		int count = 0; // Held keys
+		uint8_t bass = 0, root = 0; // Pitch classes. root is the first chord name's, or the bass
+		pitch_class_mask_t intervals = 0;
+		int16_t chord = -1, scale = -1; // Indices into the dictionary's chords / scales
+		int8_t interval = -1; // Index into interval_table for dyads and bare triads
+		bool operator==(analysis_t const&) const = default;
+
+		inline const dictionary_entry_t* chord_entry() const { return chord < 0 ? nullptr : &dictionary().chords()[chord]; }
+		inline const dictionary_entry_t* scale_entry() const { return scale < 0 ? nullptr : &dictionary().scales()[scale]; }
+	};
+	// Reentrant and allocation free
+	inline analysis_t analyze(midi_key_states_t const& state) {
+		analysis_t result;
+		if (state.empty()) return result;
+		auto const& dict = dictionary();
+		result.count = state.count();
+		result.bass = result.root = state.lowest() % 12;
+		result.intervals = state.intervals();
+		result.chord = dict.find_chord(result.intervals);
+		result.scale = dict.find_scale(result.intervals);
+		if (auto entry = result.chord_entry())
+			result.root = (result.bass + nth_interval(entry->mask, dict.names()[entry->first_name].nth_root)) % 12;
+		// intervals
+		const int num_intervals = popcount(result.intervals);
+		if (num_intervals && num_intervals < 3 && result.count > 1) {
+			pitch_class_mask_t m = result.intervals;
+			if (num_intervals == 2) m &= m - 1;
+			result.interval = countr_zero(m);
+		}
+		return result;
+	}
+	/****/
+	// Every name a recognition can produce, formatted once per bass pitch class.
+	// Name ids: the dictionary's names, then the interval names and the single note name.
+	class name_table_t {
+		string pool;
+		vector<uint32_t> offsets; // Name [id * 12 + bass] spans offsets[i] to offsets[i + 1]
+	public:
+		uint32_t interval_name_id = 0, single_note_name_id = 0;
+		name_table_t() {
+			auto const& dict = dictionary();
+			interval_name_id = dict.names().size();
+			single_note_name_id = interval_name_id + extent_of(interval_table);
+			offsets.reserve((single_note_name_id + 1) * 12 + 1);
+			offsets.push_back(0);
+			char buffer[256];
+			auto add = [&](int length) {
+				pool.append(buffer, clamp(length, 0, (int)sizeof(buffer) - 1));
+				offsets.push_back(pool.size());
+			};
+			// Names are stored in entry order
+			for (auto section : { dict.chords(), dict.scales() })
+				for (auto const& entry : section)
+					for (size_t i = 0; i < entry.name_count; i++)
+						for (int bass = 0; bass < 12; bass++)
+							add(dict.format_name(buffer, sizeof(buffer), entry, dict.names()[entry.first_name + i], bass));
+			for (auto& interval : interval_table)
+				for (int bass = 0; bass < 12; bass++)
+					add(snprintf(buffer, sizeof(buffer), "%s %s", key_table[bass], interval));
+			for (int bass = 0; bass < 12; bass++)
+				add(snprintf(buffer, sizeof(buffer), "(%s)", key_table[bass]));
+			pool.shrink_to_fit();
+		}
+		inline string_view get(uint32_t id, uint8_t bass) const {
+			const size_t i = id * 12 + bass;
+			return { pool.data() + offsets[i], offsets[i + 1] - offsets[i] };
+		}
+		inline size_t pool_size() const { return pool.size(); }
+		inline size_t count() const { return offsets.size() - 1; }
+	};
+	inline name_table_t const& name_table() {
+		static const name_table_t table;
+		return table;
+	}
+	template<typename Func> void for_each_entry_name(analysis_t const& result, const dictionary_entry_t* entry, Func&& func) {
+		if (!entry) return;
+		for (size_t i = 0; i < entry->name_count; i++)
+			func(name_table().get(entry->first_name + i, result.bass));
+	}
+	// Chord, interval and single note names of the analysis
+	template<typename Func> void for_each_chord_name(analysis_t const& result, Func&& func) {
+		if (!result.count) return;
+		// chords
+		for_each_entry_name(result, result.chord_entry(), func);
+		// intervals
+		if (result.interval >= 0)
+			func(name_table().get(name_table().interval_name_id + result.interval, result.bass));
 		// single notes
-		if (keys.size() == 1) {
-			sprintf(line_it->data(), "(%s)", key_table[bass_k]);
-			line_it++;
+		if (result.count == 1)
+			func(name_table().get(name_table().single_note_name_id, result.bass));
+	}
+	// Scale names of the analysis
+	template<typename Func> void for_each_scale_name(analysis_t const& result, Func&& func) {
+		if (result.count > 1)
+			for_each_entry_name(result, result.scale_entry(), func);
+	}
+	// Calls func(string_view) for each name of the analysis, in display order
+	template<typename Func> void for_each_name(analysis_t const& result, Func&& func) {
+		for_each_chord_name(result, func);
+		for_each_scale_name(result, func);
+	}
+	// Primary name of a dictionary chord over a bass pitch class
+	inline string_view chord_name(int16_t chord, uint8_t bass) { return name_table().get(dictionary().chords()[chord].first_name, bass); }
+	/****/
+	// Closest dictionary chords by tones missing from / extra to the interval mask
+	// Bit-parallel popcount. Unlike a popcnt instruction this vectorizes with plain SSE2.
+	constexpr uint8_t popcount_swar(pitch_class_mask_t x) {
+		x = x - ((x >> 1) & 0x5555);
+		x = (x & 0x3333) + ((x >> 2) & 0x3333);
+		x = (x + (x >> 4)) & 0x0F0F;
+		return (x + (x >> 8)) & 0x1F;
+	}
+	struct fuzzy_match_t {
+		int16_t chord = -1;
+		uint8_t missing = 0, extra = 0;
+		inline int distance() const { return missing + extra; }
+	};
+	// Fills out with the closest entries, nearest first (ties in dictionary order). Returns the match count.
+	inline size_t fuzzy_find(pitch_class_mask_t intervals, span<fuzzy_match_t> out) {
+		auto masks = dictionary().chord_masks();
+		intervals &= LOOKUP_MASK;
+		// Sort keys (distance << 11 | index) so that the smallest key is the nearest entry.
+		// Both the key pass and the min passes are branchless and vectorize. Keys are signed as SSE2 only has a signed 16-bit min.
+		alignas(64) array<int16_t, MAX_DICTIONARY_ENTRIES> keys;
+		for (size_t i = 0; i < masks.size(); i++)
+			keys[i] = (int16_t)((popcount_swar(masks[i] ^ intervals) << 11) | i);
+		const size_t count = min(out.size(), masks.size());
+		for (size_t n = 0; n < count; n++) {
+			int16_t key = INT16_MAX;
+			for (size_t i = 0; i < masks.size(); i++) key = min(key, keys[i]);
+			const size_t i = key & (MAX_DICTIONARY_ENTRIES - 1);
+			keys[i] = INT16_MAX;
+			out[n] = { (int16_t)i, popcount_swar(masks[i] & ~intervals), popcount_swar(intervals & ~masks[i]) };
 		}
+		return count;
+	}
+	// Upper bound of the names for_each_name() can yield for a single analysis with the built-in tables
+	template<size_t Size> consteval size_t max_names(const chord_item_t(&table)[Size]) {
+		size_t count = 0;
+		for (auto& item : table) count = max(count, item.second.size());
+		return count;
+	}
+	constexpr size_t MAX_NAME_COUNT = max_names(chord_table) + 1 /* interval or single note */ + max_names(scale_table);
+	// Collects the names into out. Returns how many the analysis has, more than out.size() if they did not fit.
+	inline size_t names(analysis_t const& result, span<string_view> out) {
+		size_t count = 0;
+		for_each_name(result, [&](string_view name) {
+			if (count < out.size()) out[count] = name;
+			count++;
+		});
+		return count;
+	}
+	// Copies one name per line, bounded by both the number of lines and each line's size. Returns the line count.
+	template<typename T> int format(analysis_t const& result, span<T> lines) {
+		auto line_it = lines.begin();
+		for_each_name(result, [&](string_view name) {
+			if (line_it == lines.end() || !line_it->size()) return;
+			const size_t length = min(name.size(), line_it->size() - 1);
+			memcpy(line_it->data(), name.data(), length);
+			line_it->data()[length] = 0;
+			line_it++;
+		});
 		return line_it - lines.begin();
 	}
+	template<typename T> int format(midi_key_states_t const& state, span<T> lines) {
+		return format(analyze(state), lines);
+	}
 }
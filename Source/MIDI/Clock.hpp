@@ -0,0 +1,20 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+namespace midi {
+	// Monotonic clock every event timestamp is expressed in (nanoseconds, arbitrary epoch).
+	// Backends convert their own time bases into this domain in the input callback.
+	struct clock {
+		using duration = std::chrono::nanoseconds;
+		static inline uint64_t now() {
+			return std::chrono::duration_cast<duration>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+		static inline constexpr uint64_t from_ms(uint64_t ms) { return ms * 1000000; }
+		static inline constexpr uint64_t from_us(uint64_t us) { return us * 1000; }
+		static inline constexpr uint64_t to_us(uint64_t ns) { return ns / 1000; }
+		// Converts a tick count of a clock running at frequency Hz into nanoseconds
+		static inline constexpr uint64_t from_ticks(uint64_t ticks, uint64_t frequency) {
+			return ticks / frequency * 1000000000 + ticks % frequency * 1000000000 / frequency;
+		}
+	};
+}
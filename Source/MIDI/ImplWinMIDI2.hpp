@@ -13,9 +13,25 @@ namespace midi {
 		MidiEndpointConnection port{ nullptr };
 		event_token port_revoke{};
 		uint32_t index = 0;		
+		array<char, MAX_SYSEX_MESSAGE_SIZE> sysExStaging{};
+		size_t sysExStagingSize = 0;
+		uint64_t sysExTimestamp = 0;
+		// UMP SysEx7 carries 6 bytes per packet, these are coalesced into chunks before being queued
+		inline void stageSysEx(uint8_t data) {
+			if (sysExStagingSize == sysExStaging.size()) flushSysEx();
+			sysExStaging[sysExStagingSize++] = data;
+		}
+		inline void flushSysEx() {
+			if (sysExStagingSize) pushSysEx(sysExStaging.data(), sysExStagingSize, sysExTimestamp);
+			sysExStagingSize = 0;
+		}
 		static void MidiInProc(inputContext_WinMIDI2* ctx, winrt::Microsoft::Windows::Devices::Midi2::IMidiMessageReceivedEventArgs const& args) {
-			unique_lock<mutex> lock(ctx->messageMutex);
 			auto ump = args.GetMessagePacket();
+			// UMP timestamps are MidiClock (QPC) ticks, rebase them onto midi::clock through the current time of both clocks
+			uint64_t now = clock::now(), midiNow = MidiClock::Now(), midiTimestamp = ump.Timestamp();
+			uint64_t timestamp = midiTimestamp <= midiNow ?
+				now - clock::from_ticks(midiNow - midiTimestamp, MidiClock::TimestampFrequency()) :
+				now + clock::from_ticks(midiTimestamp - midiNow, MidiClock::TimestampFrequency());
 			// TODO: MIDI2 Spec
 			if (ump.PacketType() == MidiPacketType::UniversalMidiPacket32) {
 				auto ump32 = ump.as<MidiMessage32>().Word0();
@@ -24,9 +40,20 @@ namespace midi {
 				lo = ump32 & 0xFF; ump32 >>= 8;
 				status = ump32 & 0xFF; 
 				auto message = midi1_packet(status, lo, hi);
-				ctx->messages.push(message);
+				ctx->pushMessage(message, timestamp);
+			}
+			else if (ump.PacketType() == MidiPacketType::UniversalMidiPacket64) {
+				auto ump64 = ump.as<MidiMessage64>();
+				uint32_t word0 = ump64.Word0(), word1 = ump64.Word1();
+				if ((word0 >> 28) == 0x3) {
+					// SysEx7 status: 0 complete, 1 start, 2 continue, 3 end
+					uint8_t sysExStatus = (word0 >> 20) & 0xF, count = std::min<uint8_t>((word0 >> 16) & 0xF, 6);
+					uint8_t data[6] = { (uint8_t)(word0 >> 8), (uint8_t)word0, (uint8_t)(word1 >> 24), (uint8_t)(word1 >> 16), (uint8_t)(word1 >> 8), (uint8_t)word1 };
+					if (sysExStatus == 0 || sysExStatus == 1) ctx->sysExTimestamp = timestamp, ctx->stageSysEx(0xF0);
+					for (uint8_t i = 0; i < count; i++) ctx->stageSysEx(data[i]);
+					if (sysExStatus == 0 || sysExStatus == 3) ctx->stageSysEx(0xF7), ctx->flushSysEx();
+				}
 			}
-			ctx->messageCV.notify_one();
 		}
 	public:
 		inline virtual const uint32_t getIndex() const { return index; }
@@ -67,6 +94,24 @@ namespace midi {
 		MidiSession session{ nullptr };
 		MidiEndpointConnection port{ nullptr };		
 		uint32_t index = 0;
+		// Re-packs a MIDI 1.0 SysEx chunk into UMP SysEx7 packets as it arrives
+		inline void sendSysEx(sysExMessage const& msg) {
+			auto chunk = msg.payload();
+			if (chunk.empty()) return;
+			size_t begin = msg.isFirst() ? 1 : 0, end = std::max(begin, chunk.size() - (msg.isLast() ? 1 : 0));
+			size_t offset = begin;
+			do {
+				uint8_t count = (uint8_t)std::min<size_t>(end - offset, 6);
+				bool first = msg.isFirst() && offset == begin, last = msg.isLast() && offset + count == end;
+				uint32_t status = first ? (last ? 0 : 1) : (last ? 3 : 2);
+				uint8_t data[6]{};
+				memcpy(data, chunk.data() + offset, count);
+				uint32_t word0 = (0x3u << 28) | (status << 20) | ((uint32_t)count << 16) | (data[0] << 8) | data[1];
+				uint32_t word1 = (data[2] << 24) | (data[3] << 16) | (data[4] << 8) | data[5];
+				port.SendSingleMessageWords(MidiClock::Now(), word0, word1);
+				offset += count;
+			} while (offset < end);
+		}
 	public:
 		inline virtual const uint32_t getIndex() const { return index; }
 		inline virtual const bool getStatus() const { return port != nullptr; }
@@ -82,7 +127,11 @@ namespace midi {
 		}
 		/****/
 		inline virtual void sendMessage(message_t const& message) {
-			if (!getStatus()) return;
+			if (!getStatus() || message.empty()) return;
+			if (message.status == 0xF0) {
+				sendSysEx(sysExMessage::from(message));
+				return;
+			}
 			auto packet = midi1_packet(message);
 			auto sysmsg = MidiMessageBuilder::BuildSystemMessage(
 				MidiClock::Now(),
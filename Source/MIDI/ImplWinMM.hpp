@@ -5,11 +5,21 @@ namespace midi {
 		DWORD param;
 		BYTE data[4];
 	};
+	const size_t WINMM_SYSEX_BUFFER_COUNT = 4;
+	const DWORD WINMM_SYSEX_WAIT_MS = 10; // Upper bound on how long the sender misses a stop request
+	struct winMM_sysExBuffer {
+		MIDIHDR header{};
+		array<char, MAX_SYSEX_MESSAGE_SIZE> data{};
+	};
 	struct inputContext_WinMM : public inputContext {
 	private:
 		uint32_t index = 0;
 		HMIDIIN handle;
 		MMRESULT status = -1;
+		atomic<bool> running{ false };
+		// dwParam2 of MIM_DATA/MIM_LONGDATA is in milliseconds since midiInStart
+		uint64_t startTime = 0;
+		array<winMM_sysExBuffer, WINMM_SYSEX_BUFFER_COUNT> sysExBuffers;
 		static void CALLBACK MidiInProc(
 			HMIDIIN   hMidiIn,
 			UINT      wMsg,
@@ -17,25 +27,25 @@ namespace midi {
 			DWORD_PTR dwParam1,
 			DWORD_PTR dwParam2
 		) {
-			unique_lock<mutex> lock(ctx->messageMutex);
 			switch (wMsg)
 			{
 			case MIM_OPEN:
 				break;
 			case MIM_LONGDATA:
+			case MIM_LONGERROR:
 			{
+				// Dumps larger than one buffer arrive over several MIM_LONGDATA, each is forwarded as it comes.
+				// MIM_LONGERROR returns the buffer of an incomplete or aborted dump, its partial chunk is dropped.
 				MIDIHDR* hdr = (MIDIHDR*)dwParam1;
-				ctx->messages.push(make_shared<sysExMessage::element_type>(
-					*(char**)hdr->lpData, hdr->dwBytesRecorded
-				));
+				if (wMsg == MIM_LONGDATA && hdr->dwBytesRecorded) ctx->pushSysEx(hdr->lpData, hdr->dwBytesRecorded, ctx->startTime + clock::from_ms(dwParam2));
+				if (ctx->running) midiInAddBuffer(hMidiIn, hdr, sizeof(MIDIHDR));
 				break;
 			}
 			case MIM_DATA: {
 				winMM_message message{ .param = (DWORD)dwParam1 };
 				uint8_t hi = message.data[2], lo = message.data[1], status = message.data[0];				
 				auto msg = midi1_packet(status, lo, hi);
-				ctx->messages.push(msg);
-				ctx->messageCV.notify_one();
+				ctx->pushMessage(msg, ctx->startTime + clock::from_ms(dwParam2));
 			}
 			default:
 				break;
@@ -47,11 +57,25 @@ namespace midi {
 		inline inputContext_WinMM() {};
 		inline inputContext_WinMM(inputDevice_t const& device) : index(device.index) {
 			status = midiInOpen(&handle, index, (DWORD_PTR)MidiInProc, (DWORD_PTR)this, CALLBACK_FUNCTION);
-			if (status == MMSYSERR_NOERROR) midiInStart(handle);
+			if (status == MMSYSERR_NOERROR) {
+				for (auto& buffer : sysExBuffers) {
+					buffer.header.lpData = buffer.data.data();
+					buffer.header.dwBufferLength = (DWORD)buffer.data.size();
+					midiInPrepareHeader(handle, &buffer.header, sizeof(MIDIHDR));
+					midiInAddBuffer(handle, &buffer.header, sizeof(MIDIHDR));
+				}
+				running = true;
+				startTime = clock::now();
+				midiInStart(handle);
+			}
 		}
 		inline ~inputContext_WinMM() {
 			if (status == MMSYSERR_NOERROR) {
+				running = false;
 				midiInStop(handle);
+				midiInReset(handle);
+				for (auto& buffer : sysExBuffers)
+					midiInUnprepareHeader(handle, &buffer.header, sizeof(MIDIHDR));
 				midiInClose(handle);
 			}
 		}
@@ -77,21 +101,68 @@ namespace midi {
 		uint32_t index = 0;
 		HMIDIOUT handle;
 		MMRESULT status = -1;
+		array<winMM_sysExBuffer, WINMM_SYSEX_BUFFER_COUNT> sysExBuffers;
+		size_t sysExNext = 0;
+		// A 2 KB chunk takes the better part of a second on a DIN port, so long messages are handed to their own
+		// thread instead of holding up the caller. Each queued chunk keeps a reference to its pool buffer.
+		spsc_ring<message_t, MAX_SYSEX_POOL_SIZE> sysExQueue;
+		HANDLE sysExDone = NULL; // Signalled by the driver as each buffer completes
+		jthread sysExSender;
+		// Buffers are recycled round-robin once the driver is done with them
+		inline void sendSysEx(stop_token const& stop, span<char> chunk) {
+			auto& buffer = sysExBuffers[sysExNext++ % WINMM_SYSEX_BUFFER_COUNT];
+			if (buffer.header.dwFlags & MHDR_PREPARED)
+				while (midiOutUnprepareHeader(handle, &buffer.header, sizeof(MIDIHDR)) == MIDIERR_STILLPLAYING) {
+					if (stop.stop_requested()) return;
+					WaitForSingleObject(sysExDone, WINMM_SYSEX_WAIT_MS);
+				}
+			memcpy(buffer.data.data(), chunk.data(), chunk.size());
+			buffer.header = MIDIHDR{ .lpData = buffer.data.data(), .dwBufferLength = (DWORD)chunk.size() };
+			midiOutPrepareHeader(handle, &buffer.header, sizeof(MIDIHDR));
+			midiOutLongMsg(handle, &buffer.header, sizeof(MIDIHDR));
+		}
+		inline void sendSysExLoop(stop_token stop) {
+			message_t message;
+			while (!stop.stop_requested()) {
+				if (!sysExQueue.wait_for(chrono::milliseconds(WINMM_SYSEX_WAIT_MS))) continue;
+				while (!stop.stop_requested() && sysExQueue.pop(message)) {
+					sendSysEx(stop, sysExMessage::from(message).payload());
+					release(message);
+				}
+			}
+		}
 	public:
 		inline virtual const uint32_t getIndex() const { return index; }
 		inline virtual const bool getStatus() const { return status == MMSYSERR_NOERROR; }
 		inline outputContext_WinMM() {};
 		inline outputContext_WinMM(outputDevice_t const& device) : index(device.index) {
-			status = midiOutOpen(&handle, index, NULL, NULL, CALLBACK_NULL);
+			sysExDone = CreateEventW(NULL, FALSE, FALSE, NULL);
+			status = midiOutOpen(&handle, index, (DWORD_PTR)sysExDone, NULL, CALLBACK_EVENT);
+			if (status == MMSYSERR_NOERROR)
+				sysExSender = jthread([this](stop_token stop) { sendSysExLoop(stop); });
 		}
 		inline ~outputContext_WinMM() {
+			if (sysExSender.joinable()) sysExSender.request_stop(), sysExSender.join();
+			for (message_t message; sysExQueue.pop(message);) release(message);
 			if (status == MMSYSERR_NOERROR) {
+				midiOutReset(handle);
+				for (auto& buffer : sysExBuffers)
+					if (buffer.header.dwFlags & MHDR_PREPARED)
+						midiOutUnprepareHeader(handle, &buffer.header, sizeof(MIDIHDR));
 				midiOutClose(handle);
 			}
+			if (sysExDone) CloseHandle(sysExDone);
 		}
 		/****/
 		inline virtual void sendMessage(message_t const& message) {
-			if (!getStatus()) return;
+			if (!getStatus() || message.empty()) return;
+			if (message.status == 0xF0) {
+				// Short messages sent meanwhile may overtake a queued dump. Dropped if the queue is full.
+				if (sysExMessage::from(message).payload().empty()) return;
+				sysex_pool().retain(message.handle);
+				if (!sysExQueue.push(message)) sysex_pool().release(message.handle);
+				return;
+			}
 			auto packet = midi1_packet(message);
 			winMM_message data{ .data = { packet.status, packet.lo, packet.hi } };
 			midiOutShortMsg(handle, data.param);
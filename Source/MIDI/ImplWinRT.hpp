@@ -11,38 +11,37 @@ namespace midi {
 	private:
 		uint32_t index = 0;
 		MidiInPort port{ nullptr };
+		// IMidiMessage::Timestamp() is relative to the creation of the port
+		uint64_t startTime = 0;
 		static void MidiInProc(inputContext_WinRT* ctx, Windows::Devices::Midi::IMidiMessageReceivedEventArgs const& args) {
-			unique_lock<mutex> lock(ctx->messageMutex);
 			auto message = args.Message();
+			uint64_t timestamp = ctx->startTime + chrono::duration_cast<clock::duration>(message.Timestamp()).count();
 			switch (message.Type())
 			{
 			case Windows::Devices::Midi::MidiMessageType::NoteOn:
-				ctx->messages.push(noteOnMessage{ message.as<MidiNoteOnMessage>().Channel(), message.as<MidiNoteOnMessage>().Note(), message.as<MidiNoteOnMessage>().Velocity() });
+				ctx->pushMessage(noteOnMessage{ message.as<MidiNoteOnMessage>().Channel(), message.as<MidiNoteOnMessage>().Note(), message.as<MidiNoteOnMessage>().Velocity() }, timestamp);
 				break;
 			case Windows::Devices::Midi::MidiMessageType::NoteOff:
-				ctx->messages.push(noteOffMessage{ message.as<MidiNoteOffMessage>().Channel(), message.as<MidiNoteOffMessage>().Note() });
+				ctx->pushMessage(noteOffMessage{ message.as<MidiNoteOffMessage>().Channel(), message.as<MidiNoteOffMessage>().Note() }, timestamp);
 				break;
 			case Windows::Devices::Midi::MidiMessageType::ProgramChange:
-				ctx->messages.push(programChangeMessage{ message.as<MidiProgramChangeMessage>().Channel(), message.as<MidiProgramChangeMessage>().Program() });
+				ctx->pushMessage(programChangeMessage{ message.as<MidiProgramChangeMessage>().Channel(), message.as<MidiProgramChangeMessage>().Program() }, timestamp);
 				break;
 			case Windows::Devices::Midi::MidiMessageType::PitchBendChange:
-				ctx->messages.push(pitchBendMessage{ message.as<MidiPitchBendChangeMessage>().Channel(), message.as<MidiPitchBendChangeMessage>().Bend() });
+				ctx->pushMessage(pitchBendMessage{ message.as<MidiPitchBendChangeMessage>().Channel(), message.as<MidiPitchBendChangeMessage>().Bend() }, timestamp);
 				break;
 			case Windows::Devices::Midi::MidiMessageType::ControlChange:
-				ctx->messages.push(controlChangeMessage{ message.as<MidiControlChangeMessage>().Channel(), message.as<MidiControlChangeMessage>().Controller(), message.as<MidiControlChangeMessage>().ControlValue() });
+				ctx->pushMessage(controlChangeMessage{ message.as<MidiControlChangeMessage>().Channel(), message.as<MidiControlChangeMessage>().Controller(), message.as<MidiControlChangeMessage>().ControlValue() }, timestamp);
 				break;
 			case Windows::Devices::Midi::MidiMessageType::SystemExclusive:
 			{
 				auto sysex = message.as<MidiSystemExclusiveMessage>();
-				ctx->messages.push(make_shared<sysExMessage::element_type>(
-					(char*)sysex.RawData().data(), sysex.RawData().Length()
-				));
+				ctx->pushSysEx((char*)sysex.RawData().data(), sysex.RawData().Length(), timestamp);
 				break;
 			}
 			default:
 				break;
 			}
-			ctx->messageCV.notify_one();
 		}
 	public:
 		inline virtual const uint32_t getIndex() const { return index; }
@@ -51,6 +50,8 @@ namespace midi {
 		inline inputContext_WinRT(inputDevice_t const& device) : index(device.index) {
 			auto co = [&]() -> IAsyncAction {
 				auto task = co_await MidiInPort::FromIdAsync(to_hstring(device.id));
+				// The port exists by now, anchoring before the open would make every timestamp early by its duration
+				startTime = clock::now();
 				if (task) {
 					port = task.as<MidiInPort>();
 					port.MessageReceived([&](auto&& sender, auto&& args) { MidiInProc(this, args); });
@@ -99,7 +100,7 @@ namespace midi {
 		/****/
 		inline virtual void sendMessage(message_t const& message) {
 			if (!getStatus()) return;
-			visit(visitor{
+			dispatch(message, visitor{
 				[&](noteOnMessage const& msg) {
 					port.SendMessageW(MidiNoteOnMessage(msg.channel, msg.note, msg.velocity));
 				},
@@ -116,11 +117,14 @@ namespace midi {
 					port.SendMessageW(MidiControlChangeMessage(msg.channel, msg.controller, msg.value));
 				},
 				[&](sysExMessage const& msg) {
-					Buffer buffer(msg->size());
-					memcpy(buffer.data(), msg->data(), msg->size());
+					auto payload = msg.payload();
+					if (payload.empty()) return;
+					Buffer buffer((uint32_t)payload.size());
+					memcpy(buffer.data(), payload.data(), payload.size());
+					buffer.Length((uint32_t)payload.size());
 					port.SendMessageW(MidiSystemExclusiveMessage(buffer));
 				}
-				}, message);
+				});
 		}
 		inline virtual std::string getMidiErrorMessage() { return "Unknown Error (WinRT)"; }
 		inline virtual void getMidiOutDevices(midiOutputDevices_t& result) {
@@ -1,7 +1,9 @@
 #pragma once
+#include "Clock.hpp"
 namespace midi {
 	const size_t MAX_CHANNEL_COUNT = 16;
 	const size_t MAX_SYSEX_MESSAGE_SIZE = 2048;
+	const size_t MAX_QUEUED_MESSAGE_COUNT = 4096;
 
 	using namespace std;
 	struct inputDevice_t { uint32_t index; string name; string id; };
@@ -9,66 +11,310 @@ namespace midi {
 	typedef vector<inputDevice_t> midiInputDevices_t;
 	typedef vector<outputDevice_t> midiOutputDevices_t;
 	/****/
-	struct noteOnMessage { uint8_t channel, note, velocity; };
-	struct noteOffMessage { uint8_t channel, note, velocity; };
-	struct pitchBendMessage { uint8_t channel; unsigned short level; };
-	struct programChangeMessage { uint8_t channel, program; };
-	struct controlChangeMessage { uint8_t channel, controller, value; };
-	using sysExMessage = shared_ptr<fixed_vector<char, MAX_SYSEX_MESSAGE_SIZE>>;
-	using message_t = variant<noteOnMessage, noteOffMessage, programChangeMessage, pitchBendMessage, controlChangeMessage, sysExMessage, nullopt_t>;	
+	const size_t MAX_SYSEX_POOL_SIZE = 64;
+	// SysEx is delivered as a stream of chunks of at most MAX_SYSEX_MESSAGE_SIZE bytes.
+	// A dump is the chunk flagged SYSEX_BEGIN (starts with 0xF0) up to the one flagged SYSEX_END (ends with 0xF7).
+	enum messageFlags : uint8_t {
+		SYSEX_BEGIN = 1 << 0,
+		SYSEX_END = 1 << 1
+	};
+	// Decoding: per status byte message class, type and the number of data bytes that follow it
+	enum class statusKind : uint8_t { invalid, channel, common, realtime, sysExBegin, sysExEnd };
+	enum class messageType : uint8_t { none, noteOff, noteOn, polyPressure, controlChange, programChange, channelPressure, pitchBend, sysEx, system, COUNT };
+	struct statusInfo { statusKind kind; uint8_t length; messageType type; };
+	constexpr array<statusInfo, 256> status_table = [] {
+		array<statusInfo, 256> table{};
+		constexpr messageType channel_types[] = {
+			messageType::noteOff, messageType::noteOn, messageType::polyPressure, messageType::controlChange,
+			messageType::programChange, messageType::channelPressure, messageType::pitchBend
+		};
+		for (int status = 0x80; status < 0xF0; status++) {
+			uint8_t type = status >> 4;
+			table[status] = { statusKind::channel, (uint8_t)(type == 0xC || type == 0xD ? 1 : 2), channel_types[type - 0x8] };
+		}
+		for (int status = 0xF1; status <= 0xFF; status++)
+			table[status] = { statusKind::invalid, 0, messageType::system };
+		table[0xF0] = { statusKind::sysExBegin, 0, messageType::sysEx };
+		table[0xF1] = { statusKind::common, 1, messageType::system }; // MTC Quarter Frame
+		table[0xF2] = { statusKind::common, 2, messageType::system }; // Song Position Pointer
+		table[0xF3] = { statusKind::common, 1, messageType::system }; // Song Select
+		table[0xF6] = { statusKind::common, 0, messageType::system }; // Tune Request
+		table[0xF7] = { statusKind::sysExEnd, 0, messageType::none };
+		for (int status : { 0xF8, 0xFA, 0xFB, 0xFC, 0xFE, 0xFF })
+			table[status] = { statusKind::realtime, 0, messageType::system };
+		return table;
+	}();
+	// Encoding: status byte (sans channel) per channel message type
+	constexpr array<uint8_t, (size_t)messageType::COUNT> type_status_table = [] {
+		array<uint8_t, (size_t)messageType::COUNT> table{};
+		for (int status = 0xF0; status >= 0x80; status -= 0x10)
+			table[(size_t)status_table[status].type] = (uint8_t)status;
+		return table;
+	}();
+	inline constexpr uint8_t encode_status(messageType type, uint8_t channel) {
+		return type_status_table[(size_t)type] | (channel & 0xF);
+	}
+	// Compact MIDI event. Channel/system messages are kept as their wire bytes,
+	// SysEx payloads live in the sysExPool and are referenced by handle.
+	// timestamp is the capture time in midi::clock nanoseconds, 0 for locally generated messages.
+	struct message_t {
+		uint64_t timestamp = 0;
+		uint8_t status = 0, lo = 0, hi = 0;
+		uint8_t flags = 0;
+		uint32_t handle = 0;
+		inline constexpr bool empty() const { return status < 0x80; }
+		inline constexpr bool hasChannel() const { return status >= 0x80 && status < 0xF0; }
+		inline constexpr uint8_t channel() const { return status & 0xF; }
+		inline constexpr void setChannel(uint8_t channel) { status = (status & 0xF0) | (channel & 0xF); }
+		inline constexpr messageType type() const { return status_table[status].type; }
+		inline constexpr uint8_t length() const { return status_table[status].length; }
+	};
+	static_assert(sizeof(message_t) == 16 && is_trivially_copyable_v<message_t>);
+	/****/
+	// Preallocated, lock-free pool of SysEx buffers. Buffers are reference counted and recycled
+	// through a tagged free list, so producers (MIDI callbacks) never touch the global allocator.
+	// Exhausting the pool drops the incoming SysEx.
+	const uint32_t INVALID_SYSEX_HANDLE = ~0u;
+	struct sysExPool {
+		using buffer_type = fixed_vector<char, MAX_SYSEX_MESSAGE_SIZE>;
+	private:
+		struct slot_t {
+			buffer_type data;
+			atomic<uint32_t> refs{ 0 };
+			atomic<uint32_t> next{ INVALID_SYSEX_HANDLE };
+		};
+		array<slot_t, MAX_SYSEX_POOL_SIZE> slots;
+		// [tag:32][index + 1:32], 0 index means empty
+		atomic<uint64_t> freeHead{ 0 };
+		atomic<uint32_t> dropped{ 0 };
+		inline void push_free(uint32_t handle) {
+			uint64_t head = freeHead.load(memory_order_relaxed), desired;
+			do {
+				uint32_t top = (uint32_t)head;
+				slots[handle].next.store(top ? top - 1 : INVALID_SYSEX_HANDLE, memory_order_relaxed);
+				desired = ((head >> 32) + 1) << 32 | (handle + 1);
+			} while (!freeHead.compare_exchange_weak(head, desired, memory_order_release, memory_order_relaxed));
+		}
+		inline uint32_t pop_free() {
+			uint64_t head = freeHead.load(memory_order_acquire), desired;
+			do {
+				uint32_t top = (uint32_t)head;
+				if (!top) return INVALID_SYSEX_HANDLE;
+				uint32_t next = slots[top - 1].next.load(memory_order_relaxed);
+				desired = ((head >> 32) + 1) << 32 | (next == INVALID_SYSEX_HANDLE ? 0 : next + 1);
+			} while (!freeHead.compare_exchange_weak(head, desired, memory_order_acquire, memory_order_acquire));
+			return (uint32_t)head - 1;
+		}
+	public:
+		inline sysExPool() {
+			for (uint32_t i = 0; i < MAX_SYSEX_POOL_SIZE; i++) push_free(i);
+		}
+		// Copies data into a free buffer. The returned handle holds one reference.
+		inline uint32_t acquire(const char* data, size_t size) {
+			uint32_t handle = pop_free();
+			if (handle == INVALID_SYSEX_HANDLE) {
+				dropped.fetch_add(1, memory_order_relaxed);
+				return handle;
+			}
+			auto& slot = slots[handle];
+			slot.data.resize(size);
+			memcpy(slot.data.data(), data, size);
+			slot.refs.store(1, memory_order_release);
+			return handle;
+		}
+		inline void retain(uint32_t handle) {
+			if (handle < MAX_SYSEX_POOL_SIZE) slots[handle].refs.fetch_add(1, memory_order_relaxed);
+		}
+		inline void release(uint32_t handle) {
+			if (handle < MAX_SYSEX_POOL_SIZE && slots[handle].refs.fetch_sub(1, memory_order_acq_rel) == 1)
+				push_free(handle);
+		}
+		inline span<char> get(uint32_t handle) {
+			if (handle >= MAX_SYSEX_POOL_SIZE) return {};
+			return slots[handle].data.span();
+		}
+		inline uint32_t getDroppedCount() const { return dropped.load(memory_order_relaxed); }
+	};
+	inline sysExPool& sysex_pool() {
+		static sysExPool pool;
+		return pool;
+	}
+	/****/
+	// Typed views over message_t. These are built on demand by dispatch() and convert back implicitly.
+	struct noteOnMessage {
+		uint8_t channel, note, velocity;
+		static constexpr messageType TYPE = messageType::noteOn;
+		inline constexpr operator message_t() const { return { .status = encode_status(TYPE, channel), .lo = note, .hi = velocity }; }
+		static inline constexpr noteOnMessage from(message_t const& m) { return { m.channel(), m.lo, m.hi }; }
+	};
+	struct noteOffMessage {
+		uint8_t channel, note, velocity;
+		static constexpr messageType TYPE = messageType::noteOff;
+		inline constexpr operator message_t() const { return { .status = encode_status(TYPE, channel), .lo = note, .hi = velocity }; }
+		static inline constexpr noteOffMessage from(message_t const& m) { return { m.channel(), m.lo, m.hi }; }
+	};
+	struct pitchBendMessage {
+		uint8_t channel; unsigned short level;
+		static constexpr messageType TYPE = messageType::pitchBend;
+		inline constexpr operator message_t() const { return { .status = encode_status(TYPE, channel), .lo = (uint8_t)(level & 0x7F), .hi = (uint8_t)((level >> 7) & 0x7F) }; }
+		static inline constexpr pitchBendMessage from(message_t const& m) { return { m.channel(), (unsigned short)(((m.hi & 0x7F) << 7) | (m.lo & 0x7F)) }; }
+	};
+	struct programChangeMessage {
+		uint8_t channel, program;
+		static constexpr messageType TYPE = messageType::programChange;
+		inline constexpr operator message_t() const { return { .status = encode_status(TYPE, channel), .lo = program }; }
+		static inline constexpr programChangeMessage from(message_t const& m) { return { m.channel(), m.lo }; }
+	};
+	struct controlChangeMessage {
+		uint8_t channel, controller, value;
+		static constexpr messageType TYPE = messageType::controlChange;
+		inline constexpr operator message_t() const { return { .status = encode_status(TYPE, channel), .lo = controller, .hi = value }; }
+		static inline constexpr controlChangeMessage from(message_t const& m) { return { m.channel(), m.lo, m.hi }; }
+	};
+	struct polyPressureMessage {
+		uint8_t channel, note, pressure;
+		static constexpr messageType TYPE = messageType::polyPressure;
+		inline constexpr operator message_t() const { return { .status = encode_status(TYPE, channel), .lo = note, .hi = pressure }; }
+		static inline constexpr polyPressureMessage from(message_t const& m) { return { m.channel(), m.lo, m.hi }; }
+	};
+	struct channelPressureMessage {
+		uint8_t channel, pressure;
+		static constexpr messageType TYPE = messageType::channelPressure;
+		inline constexpr operator message_t() const { return { .status = encode_status(TYPE, channel), .lo = pressure }; }
+		static inline constexpr channelPressureMessage from(message_t const& m) { return { m.channel(), m.lo }; }
+	};
+	// System common & realtime messages (0xF1-0xFF, except SysEx)
+	struct systemMessage {
+		uint8_t status, lo, hi;
+		inline constexpr operator message_t() const { return { .status = status, .lo = lo, .hi = hi }; }
+		static inline constexpr systemMessage from(message_t const& m) { return { m.status, m.lo, m.hi }; }
+	};
+	struct sysExMessage {
+		uint32_t handle; uint8_t flags;
+		inline constexpr operator message_t() const { return { .status = 0xF0, .flags = flags, .handle = handle }; }
+		static inline constexpr sysExMessage from(message_t const& m) { return { m.handle, m.flags }; }
+		inline span<char> payload() const { return sysex_pool().get(handle); }
+		inline bool isFirst() const { return flags & SYSEX_BEGIN; }
+		inline bool isLast() const { return flags & SYSEX_END; }
+	};
+	template<typename View, typename Func> inline constexpr void dispatch_as(message_t const& message, Func& func) {
+		View view = View::from(message);
+		func(view);
+	}
+	// Invokes func with the typed view of message. Messages without a view are ignored.
+	template<typename Func> inline constexpr void dispatch(message_t const& message, Func&& func) {
+		switch (message.type()) {
+		case messageType::noteOff: dispatch_as<noteOffMessage>(message, func); break;
+		case messageType::noteOn: dispatch_as<noteOnMessage>(message, func); break;
+		case messageType::polyPressure: dispatch_as<polyPressureMessage>(message, func); break;
+		case messageType::controlChange: dispatch_as<controlChangeMessage>(message, func); break;
+		case messageType::programChange: dispatch_as<programChangeMessage>(message, func); break;
+		case messageType::channelPressure: dispatch_as<channelPressureMessage>(message, func); break;
+		case messageType::pitchBend: dispatch_as<pitchBendMessage>(message, func); break;
+		case messageType::sysEx: dispatch_as<sysExMessage>(message, func); break;
+		case messageType::system: dispatch_as<systemMessage>(message, func); break;
+		default: break;
+		}
+	}
+	// Every status byte must survive wire bytes -> typed view -> wire bytes unchanged
+	consteval bool verify_codec() {
+		for (int status = 0x80; status <= 0xFF; status++) {
+			if (status == 0xF0 || status == 0xF7) continue;
+			for (int lo = 0; lo < 0x80; lo += 0x7F)
+				for (int hi = 0; hi < 0x80; hi += 0x3F) {
+					message_t in{ .status = (uint8_t)status }, out{};
+					if (in.length() > 0) in.lo = (uint8_t)lo;
+					if (in.length() > 1) in.hi = (uint8_t)hi;
+					bool dispatched = false;
+					dispatch(in, [&](auto& view) { out = view, dispatched = true; });
+					if (!dispatched || out.status != in.status || out.lo != in.lo || out.hi != in.hi) return false;
+				}
+		}
+		return true;
+	}
+	static_assert(verify_codec());
+	// Returns the message's pooled resources (if any). Call once a message has been fully consumed.
+	inline void release(message_t const& message) {
+		if (message.status == 0xF0) sysex_pool().release(message.handle);
+	}
 	struct midi1_packet { 
 		uint8_t status, lo, hi;
 		midi1_packet() = default;
 		explicit midi1_packet(uint8_t status, uint8_t lo, uint8_t hi) : status(status), lo(lo), hi(hi) {};
-		explicit midi1_packet(message_t const& msg) {
-			visit(visitor{
-				[&](noteOnMessage const& msg) {
-					status = (BYTE)(0x90 | msg.channel), lo = msg.note, hi = msg.velocity;					
-				},
-				[&](noteOffMessage const& msg) {
-					status = (BYTE)(0x80 | msg.channel), lo = msg.note, hi = msg.velocity;					
-				},
-				[&](programChangeMessage const& msg) {
-					status = (BYTE)(0xC0 | msg.channel), lo = msg.program, hi = 0;					
-				},
-				[&](pitchBendMessage const& msg) {
-					status = (BYTE)(0xE0 | msg.channel), lo = msg.level & 0x7F, hi = msg.level >> 7;					
-				},
-				[&](controlChangeMessage const& msg) {
-					status = (BYTE)(0x80 | msg.channel), lo = msg.controller, hi = msg.value;					
-				},
-			}, msg);
-		}
-		inline operator message_t() {
-			uint8_t msg = status >> 4, channel = status & 0xF;
-			switch (msg)
-			{
-			case 0x8:
-				return noteOffMessage{ channel, lo, hi };
-			case 0x9:
-				return noteOnMessage{ channel, lo, hi };
-			case 0xB:
-				return controlChangeMessage{ channel, lo, hi };
-			case 0xC:
-				return programChangeMessage{ channel, lo };
-			case 0xE:
-			{
-				pitchBendMessage msg{ .channel = channel };
-				msg.level = (hi & 0b01111111); msg.level <<= 7; msg.level |= (lo & 0b01111111);
-				return msg;
-			}
-			default:
-				break;
+		explicit midi1_packet(message_t const& msg) : status(msg.status), lo(msg.lo), hi(msg.hi) {};
+		inline operator message_t() const { return { .status = status, .lo = lo, .hi = hi }; }
+		inline uint8_t length() const { return status_table[status].length; }
+	};	
+	// Incremental MIDI 1.0 byte stream decoder. Handles running status, realtime bytes interleaved
+	// anywhere (including inside SysEx) and messages split across buffer boundaries.
+	// SysEx is reported as contiguous slices of the input, suitable for inputContext::pushSysEx.
+	struct midi1_parser {
+	private:
+		uint8_t status = 0, runningStatus = 0, expected = 0, count = 0;
+		uint8_t data[2]{};
+		bool inSysEx = false;
+	public:
+		template<typename MessageFunc, typename SysExFunc>
+		inline void parse(const uint8_t* bytes, size_t size, uint64_t timestamp, MessageFunc&& onMessage, SysExFunc&& onSysEx) {
+			const uint8_t* sysExBegin = inSysEx ? bytes : nullptr;
+			auto flushSysEx = [&](const uint8_t* end) {
+				if (sysExBegin && end > sysExBegin) onSysEx((const char*)sysExBegin, (size_t)(end - sysExBegin));
+				sysExBegin = nullptr;
+			};
+			for (const uint8_t* it = bytes, *end = bytes + size; it != end; it++) {
+				const uint8_t byte = *it;
+				if (byte < 0x80) {
+					if (inSysEx || !status) continue;
+					data[count++] = byte;
+					if (count == expected) {
+						onMessage(message_t{ .timestamp = timestamp, .status = status, .lo = data[0], .hi = (uint8_t)(expected > 1 ? data[1] : 0) });
+						count = 0, status = runningStatus;
+					}
+					continue;
+				}
+				const statusInfo info = status_table[byte];
+				if (byte >= 0xF8) {
+					// Realtime doesn't affect any other state
+					flushSysEx(it);
+					if (info.kind == statusKind::realtime) onMessage(message_t{ .timestamp = timestamp, .status = byte });
+					if (inSysEx) sysExBegin = it + 1;
+					continue;
+				}
+				if (inSysEx) {
+					// Any status byte terminates SysEx, normally 0xF7
+					inSysEx = false;
+					if (byte == 0xF7) { flushSysEx(it + 1); continue; }
+					flushSysEx(it);
+				}
+				count = 0;
+				switch (info.kind) {
+				case statusKind::channel:
+					status = runningStatus = byte, expected = info.length;
+					break;
+				case statusKind::common:
+					runningStatus = status = 0;
+					if (info.length) status = byte, expected = info.length;
+					else onMessage(message_t{ .timestamp = timestamp, .status = byte });
+					break;
+				case statusKind::sysExBegin:
+					runningStatus = status = 0;
+					inSysEx = true, sysExBegin = it;
+					break;
+				default:
+					runningStatus = status = 0;
+					break;
+				}
 			}
-			return nullopt;
+			if (inSysEx) flushSysEx(bytes + size);
 		}
-	};	
+		inline void reset() { status = runningStatus = count = 0, inSysEx = false; }
+	};
 	/****/
 	struct inputContext {
 	public:
-		std::queue<message_t> messages;
-		std::condition_variable messageCV;
-		std::mutex messageMutex;
+		// Written by the backend callback, read by the main loop. Messages are dropped when full.
+		spsc_ring<message_t, MAX_QUEUED_MESSAGE_COUNT> messages;
+		midi1_parser parser;
 		inline virtual const uint32_t getIndex() const = 0;
 		inline virtual const bool getStatus() const = 0;
 		inline virtual std::string getMidiErrorMessage() = 0;
@@ -77,12 +323,55 @@ namespace midi {
 		inline virtual std::optional<message_t> pollMessage(bool blocking = false) {
 			if (!getStatus())
 				return {};
-			std::unique_lock<std::mutex> lock(messageMutex);
-			if (blocking) messageCV.wait(lock, [this] { return !messages.empty(); });
-			else if (messages.empty()) return {};
-			auto message = messages.front();
-			messages.pop();
-			return message;
+			if (blocking) messages.wait();
+			message_t message{};
+			if (messages.pop(message)) return message;
+			return {};
+		}
+		// Blocks until a message is pending, ready() holds or timeout elapses, without consuming anything.
+		// Whoever makes ready() true wakes the wait with messages.notify().
+		template<typename Rep, typename Period, typename Ready = bool(*)()>
+		inline bool waitMessage(std::chrono::duration<Rep, Period> const& timeout, Ready&& ready = [] { return false; }) {
+			if (!getStatus())
+				return false;
+			return messages.wait_for(timeout, std::forward<Ready>(ready));
+		}
+		// Moves every pending message (up to out.size()) out at once. Returns the number of messages written.
+		inline virtual size_t pollMessages(std::span<message_t> out, bool blocking = false) {
+			if (!getStatus())
+				return 0;
+			if (blocking) messages.wait();
+			return messages.pop(out);
+		}
+		// Calls func(message_t&) in place for every pending message. Returns the number of messages consumed.
+		template<typename Func> inline size_t drainMessages(Func&& func) {
+			if (!getStatus())
+				return 0;
+			return messages.consume(std::forward<Func>(func));
+		}
+		// For backend callbacks. timestamp must already be in the midi::clock domain.
+		inline bool pushMessage(message_t message, uint64_t timestamp) {
+			message.timestamp = timestamp;
+			return messages.push(message);
+		}
+		// For byte stream backends (files, pipes, serial). Decodes any slice of a MIDI 1.0 stream in one pass.
+		inline void pushBytes(const uint8_t* data, size_t size, uint64_t timestamp) {
+			parser.parse(data, size, timestamp,
+				[&](message_t const& message) { messages.push(message); },
+				[&](const char* sysex, size_t length) { pushSysEx(sysex, length, timestamp); });
+		}
+		// For backend callbacks. Takes any slice of a SysEx byte stream and queues it as chunks.
+		// Never allocates, drops chunks if the pool or the queue is full.
+		inline void pushSysEx(const char* data, size_t size, uint64_t timestamp) {
+			for (size_t offset = 0; offset < size; offset += MAX_SYSEX_MESSAGE_SIZE) {
+				size_t length = std::min(size - offset, MAX_SYSEX_MESSAGE_SIZE);
+				uint8_t flags = 0;
+				if (offset == 0 && (uint8_t)data[0] == 0xF0) flags |= SYSEX_BEGIN;
+				if (offset + length == size && (uint8_t)data[size - 1] == 0xF7) flags |= SYSEX_END;
+				uint32_t handle = sysex_pool().acquire(data + offset, length);
+				if (handle != INVALID_SYSEX_HANDLE && !pushMessage(sysExMessage{ handle, flags }, timestamp))
+					sysex_pool().release(handle);
+			}
 		}
 		/****/
 		inline virtual void getMidiInDevices(midiInputDevices_t&) = 0;
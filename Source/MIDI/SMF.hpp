@@ -0,0 +1,141 @@
+#pragma once
+#include "MIDI.hpp"
+namespace midi {
+	// Standard MIDI File reader over an in-memory image (e.g. a mapped_file). Nothing is copied,
+	// events and tracks point into the image. Malformed data ends a track instead of failing the file.
+	inline uint16_t smf_be16(const uint8_t* p) { return (p[0] << 8) | p[1]; }
+	inline uint32_t smf_be32(const uint8_t* p) { return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+	struct smf_event {
+		uint64_t tick = 0;
+		uint8_t status = 0;
+		uint8_t meta = 0; // Meta event type if status is 0xFF
+		span<const uint8_t> data; // Channel message data bytes, or the meta / SysEx payload
+		inline bool isChannel() const { return status >= 0x80 && status < 0xF0; }
+		inline message_t message(uint64_t timestamp = 0) const {
+			return { .timestamp = timestamp, .status = status, .lo = data.size() > 0 ? data[0] : (uint8_t)0, .hi = data.size() > 1 ? data[1] : (uint8_t)0 };
+		}
+	};
+	class smf_track_reader {
+		const uint8_t* _it, * _end;
+		uint64_t _tick = 0;
+		uint8_t _running = 0;
+		inline bool read_vlq(uint32_t& value) {
+			value = 0;
+			for (int i = 0; i < 4 && _it != _end; i++) {
+				const uint8_t byte = *_it++;
+				value = (value << 7) | (byte & 0x7F);
+				if (!(byte & 0x80)) return true;
+			}
+			return false;
+		}
+		inline bool read_payload(smf_event& event) {
+			uint32_t length;
+			if (!read_vlq(length) || length > size_t(_end - _it)) return false;
+			event.data = { _it, length };
+			_it += length;
+			return true;
+		}
+	public:
+		inline explicit smf_track_reader(span<const uint8_t> track) : _it(track.data()), _end(track.data() + track.size()) {}
+		// False at the end of the track
+		inline bool next(smf_event& event) {
+			uint32_t delta;
+			if (!read_vlq(delta) || _it == _end) return false;
+			_tick += delta;
+			uint8_t status = *_it;
+			if (status & 0x80) _it++;
+			else if (_running) status = _running;
+			else return false;
+			event.tick = _tick, event.status = status, event.meta = 0;
+			switch (status) {
+				case 0xFF:
+					// Meta events and SysEx cancel running status
+					_running = 0;
+					if (_it == _end) return false;
+					event.meta = *_it++;
+					return read_payload(event) && event.meta != 0x2F /* End of Track */;
+				case 0xF0:
+				case 0xF7:
+					_running = 0;
+					return read_payload(event);
+				default:
+					if (status >= 0xF0) return false; // Not valid in files
+					_running = status;
+					const uint8_t length = status_table[status].length;
+					if (length > _end - _it) return false;
+					// A status byte inside the data means the track is corrupt
+					for (uint8_t i = 0; i < length; i++)
+						if (_it[i] & 0x80) return false;
+					event.data = { _it, length };
+					_it += length;
+					return true;
+			}
+		}
+	};
+	// Tick to nanosecond conversion. Tempo changes must be added in tick order.
+	class smf_tempo_map {
+		struct entry_t { uint64_t tick; double ns; double ns_per_tick; };
+		vector<entry_t> _entries;
+		uint16_t _division;
+		inline bool smpte() const { return _division & 0x8000; }
+		inline double ns_per_tick(uint32_t tempo) const { return tempo * 1000.0 / _division; }
+	public:
+		static constexpr uint32_t DEFAULT_TEMPO = 500000; // us per quarter note, 120 BPM
+		inline explicit smf_tempo_map(uint16_t division = 96) : _division(division ? division : 96) {
+			if (smpte()) {
+				const int fps = -(int8_t)(_division >> 8), ticks_per_frame = _division & 0xFF;
+				_entries.push_back({ 0, 0, 1e9 / ((fps == 29 ? 29.97 : fps) * max(ticks_per_frame, 1)) });
+			}
+			else
+				_entries.push_back({ 0, 0, ns_per_tick(DEFAULT_TEMPO) });
+		}
+		inline void add(uint64_t tick, uint32_t tempo) {
+			// SMPTE time is absolute
+			if (smpte() || !tempo) return;
+			auto const& last = _entries.back();
+			if (tick < last.tick) return;
+			_entries.push_back({ tick, last.ns + (tick - last.tick) * last.ns_per_tick, ns_per_tick(tempo) });
+		}
+		inline void add(smf_event const& event) {
+			if (event.status == 0xFF && event.meta == 0x51 && event.data.size() == 3)
+				add(event.tick, (event.data[0] << 16) | (event.data[1] << 8) | event.data[2]);
+		}
+		inline uint64_t to_ns(uint64_t tick) const {
+			auto it = upper_bound(_entries.begin(), _entries.end(), tick, [](uint64_t tick, entry_t const& entry) { return tick < entry.tick; }) - 1;
+			return it->ns + (tick - it->tick) * it->ns_per_tick;
+		}
+	};
+	struct smf_file {
+		uint16_t format = 0, division = 0;
+		vector<span<const uint8_t>> tracks;
+		// Format 0/1 files share the first track's tempo map, format 2 tracks carry their own
+		vector<smf_tempo_map> tempo_maps;
+		inline smf_tempo_map const& tempo_map(size_t track) const { return tempo_maps[min(track, tempo_maps.size() - 1)]; }
+		// False if the image is not a Standard MIDI File
+		inline bool parse(span<const char> image) {
+			auto it = (const uint8_t*)image.data(), end = it + image.size();
+			if (image.size() < 14 || memcmp(it, "MThd", 4)) return false;
+			const uint32_t header_length = smf_be32(it + 4);
+			if (header_length < 6 || header_length > image.size() - 8) return false;
+			format = smf_be16(it + 8), division = smf_be16(it + 12);
+			const uint16_t track_count = smf_be16(it + 10);
+			it += 8 + header_length;
+			tracks.clear();
+			while (end - it >= 8 && tracks.size() < track_count) {
+				const uint8_t* data = it + 8;
+				// Truncated files keep what is there
+				const size_t length = min<size_t>(smf_be32(it + 4), end - data);
+				if (!memcmp(it, "MTrk", 4)) tracks.emplace_back(data, length);
+				it = data + length;
+			}
+			tempo_maps.clear();
+			for (size_t i = 0; i < (format == 2 ? tracks.size() : min<size_t>(tracks.size(), 1)); i++) {
+				smf_tempo_map& map = tempo_maps.emplace_back(division);
+				smf_track_reader reader(tracks[i]);
+				for (smf_event event; reader.next(event);) map.add(event);
+			}
+			if (tempo_maps.empty()) tempo_maps.emplace_back(division);
+			return true;
+		}
+	};
+}
@@ -11,9 +11,13 @@
 #include "MIDI/Data/GM.hpp"
 
 #include "chord.hpp"
+#include "Tonality.hpp"
+#include "Smoothing.hpp"
+#include "Analysis.hpp"
 #include <ImTUI/third-party/imgui/imgui/imgui.h>
 
 #define CONFIG_FILENAME "config"
+#define DICTIONARY_FILENAME "dictionary"
 struct {
 	int inputBackend = 0;
 	int inputChannel = 0;	
@@ -23,6 +27,11 @@ struct {
 	int outputDeviceIndex = 0;
 	int outputChannel = 0;
 	int keyboardKeymap[256]{};
+	bool chordAllChannels = false;
+	bool chordClosest = false;
+	bool chordSmoothing = false;
+	int chordWindowMs = 0;
+	bool chordSounding = false;
 	void save() {
 		FILE* file = fopen(CONFIG_FILENAME, "wb");
 		ASSERT(file, L"Failed to open file for writing");
@@ -89,21 +98,117 @@ midiInContext_t g_midiInContext;
 midiOutContext_t g_midiOutContext;
 midi::midiInputDevices_t g_midiInDevices;
 midi::midiOutputDevices_t g_midiOutDevices;
-struct {
-	bool muted = false, solo = false, hold = false;
-	int program;
-	chord::midi_key_states_t keys;
+struct channelState_t {
+	int program = 0;
+	chord::midi_key_states_t keys{};
+	tonality::histogram_t pitches{};
+	chord::onset_window_t onsets{};
+	chord::sounding_keys_t sounding{};
 	struct {
 		int pitchBend = 0x2000;
 		uint8_t cc[128]{};
 	} controls;
-} g_midiChannelStates[midi::MAX_CHANNEL_COUNT];
-const uint8_t ACTIVE_INPUT_FRAMES = 3;
+	// Keeps the key estimate's histogram and the sounding keys in step with the keys
+	void set_key(uint8_t note, uint8_t velocity, uint64_t time) {
+		note &= chord::midi_key_states_t::NOTE_COUNT - 1; // Malformed data bytes from the driver
+		if (!keys[note] != !velocity) pitches.note(note, velocity, time);
+		keys.set(note, velocity);
+		sounding.note(note, velocity);
+	}
+};
+// Written by the router only and published per channel. The UI reads the snapshots refreshed each frame.
+std::array<seqlock<channelState_t>, midi::MAX_CHANNEL_COUNT> g_midiChannelStates;
+std::array<channelState_t, midi::MAX_CHANNEL_COUNT> g_channelSnapshots;
+std::array<uint32_t, midi::MAX_CHANNEL_COUNT> g_channelSnapshotVersions;
+// Written by the UI, read by the router
+struct {
+	std::atomic<bool> muted = false, solo = false, hold = false;
+} g_channelSettings[midi::MAX_CHANNEL_COUNT];
+// The g_config fields the router reads. g_config itself belongs to the UI, which republishes these every frame
+// and before the router starts.
+struct {
+	std::atomic<int> inputChannel = 0, inputChannelRemap = -1, chordWindowMs = 0;
+	std::array<std::atomic<int>, 256> keyboardKeymap{};
+	void publish() {
+		inputChannel.store(g_config.inputChannel, std::memory_order_relaxed);
+		inputChannelRemap.store(g_config.inputChannelRemap, std::memory_order_relaxed);
+		chordWindowMs.store(g_config.chordWindowMs, std::memory_order_relaxed);
+		for (size_t i = 0; i < keyboardKeymap.size(); i++) keyboardKeymap[i].store(g_config.keyboardKeymap[i], std::memory_order_relaxed);
+	}
+} g_routerConfig;
+// Capture (backend timestamp) to sendMessage, in midi::clock nanoseconds. Written by the router.
+struct {
+	std::atomic<uint64_t> last = 0, average = 0, max = 0;
+	void record(uint64_t latency) {
+		uint64_t avg = average.load(std::memory_order_relaxed);
+		last.store(latency, std::memory_order_relaxed);
+		max.store(std::max(max.load(std::memory_order_relaxed), latency), std::memory_order_relaxed);
+		average.store(avg ? avg - avg / 16 + latency / 16 : latency, std::memory_order_relaxed);
+	}
+} g_passthroughLatency;
+const uint64_t ACTIVE_INPUT_DURATION = midi::clock::from_ms(100);
+std::array<std::atomic<uint64_t>, midi::MAX_CHANNEL_COUNT> g_lastChannelInput;
 std::array<int, midi::MAX_CHANNEL_COUNT> g_activeInputs;
 /****/
-fixed_matrix<char, 256, 256> g_chordNames;
+// Routing runs on its own thread so passthrough never waits on the UI frame.
+// The UI never sends directly, messages it generates are queued to the router instead.
+const auto ROUTER_WAKE_INTERVAL = std::chrono::milliseconds(10);
+// Room for a note off on every key of every channel, the most Solo can queue in one frame
+spsc_ring<midi::message_t, std::bit_ceil(midi::MAX_CHANNEL_COUNT * 128 + 1)> g_localMessages;
+// UI only. Whatever the ring had no room for, in order, retried every frame.
+std::queue<midi::message_t> g_localBacklog;
+std::jthread g_router;
+void route_loop(std::stop_token stop);
+void start_router() {
+	g_router = std::jthread(route_loop);
+}
+void stop_router() {
+	if (g_router.joinable()) g_router.request_stop(), g_router.join();
+}
+void flush_local_messages() {
+	bool pushed = false;
+	while (!g_localBacklog.empty() && g_localMessages.push(g_localBacklog.front()))
+		g_localBacklog.pop(), pushed = true;
+	// The router sleeps on the input ring while there is one
+	if (pushed && g_midiInContext) g_midiInContext->messages.notify();
+}
+void send_local_message(midi::message_t const& message) {
+	g_localBacklog.push(message);
+	flush_local_messages();
+}
+/****/
+// Views into chord::name_table()
+fixed_vector<std::string_view, chord::MAX_NAME_COUNT> g_chordNames;
+size_t g_chordNamesOverflow = 0;
+// Nearest chord_table entries to the same keys, over g_chordClosestBass
+constexpr size_t CHORD_CLOSEST_COUNT = 5;
+fixed_vector<chord::fuzzy_match_t, CHORD_CLOSEST_COUNT> g_chordClosest;
+uint8_t g_chordClosestBass = 0;
+// Chord names are reformatted only when the analysed keys change what they would read
+constexpr int CHORD_SOURCE_ALL_CHANNELS = midi::MAX_CHANNEL_COUNT;
+struct {
+	int channel = -1; // Or CHORD_SOURCE_ALL_CHANNELS for every channel merged
+	chord::format_key_t key{};
+} g_chordNamesSource;
+// First chord name of each channel, for the all channels view
+std::array<std::string_view, midi::MAX_CHANNEL_COUNT> g_channelChordNames;
+// Running key of the same source, re-estimated whenever its keys change
+tonality::estimate_t g_chordKey;
+// Stepped once per chord change of the same source while smoothing is on
+smoothing::decoder_t g_chordDecoder;
+// Arpeggio window in midi::clock nanoseconds, 0 when off
+uint64_t chord_window(int ms = g_config.chordWindowMs) {
+	return midi::clock::from_ms(std::max(0, ms));
+}
+// What the chord display analyses: the held or the sounding keys, and with the arpeggio window on, every key struck within it
+chord::midi_key_states_t chord_keys(channelState_t const& state) {
+	chord::midi_key_states_t keys = g_config.chordSounding ? state.sounding.keys : state.keys;
+	if (chord_window()) keys.merge(state.onsets.keys);
+	return keys;
+}
 /****/
 void setup() {
+	stop_router();
 	g_midiInContext = make_midi_input_context();
 	g_midiInContext->getMidiInDevices(g_midiInDevices);
 	if (g_midiInDevices.size())
@@ -114,14 +219,17 @@ void setup() {
 	if (g_midiOutDevices.size())
 		g_midiOutContext = make_midi_output_context(g_midiOutDevices[std::min(g_midiOutDevices.size() - 1, (size_t)g_config.outputDeviceIndex)]);
 	if (g_midiInContext->getStatus())
-		g_midiOutContext->sendMessage(midi::programChangeMessage{ (BYTE)g_config.outputChannel, (BYTE)g_midiChannelStates[g_config.outputChannel].program });
+		g_midiOutContext->sendMessage(midi::programChangeMessage{ (BYTE)g_config.outputChannel, (BYTE)g_midiChannelStates[g_config.outputChannel].get().program });
+	g_routerConfig.publish();
+	start_router();
 }
-void poll_input() {
+void route_message(midi::message_t& message) {
 	auto map_midi_to_keystroke = [&](uint8_t velocity, uint8_t key) {
-		if (g_config.keyboardKeymap[key]) {
+		const int vk = g_routerConfig.keyboardKeymap[key].load(std::memory_order_relaxed);
+		if (vk) {
 			INPUT input{};
 			input.type = INPUT_KEYBOARD;
-			int scan = MapVirtualKeyA(g_config.keyboardKeymap[key], MAPVK_VK_TO_VSC);
+			int scan = MapVirtualKeyA(vk, MAPVK_VK_TO_VSC);
 			input.ki.wScan = scan;
 			input.ki.dwFlags = velocity ? 0 : KEYEVENTF_KEYUP;
 			input.ki.dwFlags |= KEYEVENTF_SCANCODE;
@@ -129,58 +237,98 @@ void poll_input() {
 		}
 		};
 	using namespace midi;
+	bool passthrough = true;
+	const uint64_t time = message.timestamp ? message.timestamp : midi::clock::now();
+	const uint64_t window = chord_window(g_routerConfig.chordWindowMs.load(std::memory_order_relaxed));
+	const int inputChannel = g_routerConfig.inputChannel.load(std::memory_order_relaxed);
+	dispatch(message, visitor{
+		[&](noteOnMessage& msg) {
+			if (g_channelSettings[msg.channel].hold && msg.velocity == 0)
+				passthrough = false;
+			else
+				g_midiChannelStates[msg.channel].write([&](channelState_t& state) {
+					state.set_key(msg.note, msg.velocity, time);
+					if (msg.velocity && window) state.onsets.add(msg.note, msg.velocity, time, window);
+				});
+			if (msg.channel == inputChannel)
+				map_midi_to_keystroke(msg.velocity, msg.note);
+			if (g_channelSettings[msg.channel].muted)
+				passthrough = false;
+		},
+		[&](noteOffMessage& msg) {
+			if (!g_channelSettings[msg.channel].hold)
+				g_midiChannelStates[msg.channel].write([&](channelState_t& state) { state.set_key(msg.note, 0, time); });
+			else
+				passthrough = false;
+			if (msg.channel == inputChannel)
+				map_midi_to_keystroke(0, msg.note);
+		},
+		[&](pitchBendMessage& msg) {
+			g_midiChannelStates[msg.channel].write([&](channelState_t& state) { state.controls.pitchBend = msg.level; });
+		},
+		[&](controlChangeMessage& msg) {
+			g_midiChannelStates[msg.channel].write([&](channelState_t& state) {
+				state.controls.cc[msg.controller] = msg.value;
+				state.sounding.control(msg.controller, msg.value, state.keys);
+			});
+		},
+		[&](programChangeMessage& msg) {
+			g_midiChannelStates[msg.channel].write([&](channelState_t& state) { state.program = msg.program; });
+		}
+		});
+	if (g_midiOutContext) {
+		if (message.hasChannel()) {
+			g_lastChannelInput[message.channel()].store(midi::clock::now(), std::memory_order_relaxed);
+			const int remap = g_routerConfig.inputChannelRemap.load(std::memory_order_relaxed);
+			if (message.channel() == inputChannel && remap >= 0)
+				message.setChannel(remap);
+		}
+		if (passthrough) {
+			g_midiOutContext->sendMessage(message);
+			uint64_t now = midi::clock::now();
+			if (message.timestamp && now > message.timestamp)
+				g_passthroughLatency.record(now - message.timestamp);
+		}
+	}
+	release(message);
+}
+// Messages generated by the UI. These bypass channel settings and remapping.
+void route_local_message(midi::message_t& message) {
+	using namespace midi;
+	dispatch(message, visitor{
+		[&](noteOffMessage& msg) {
+			g_midiChannelStates[msg.channel].write([&](channelState_t& state) { state.set_key(msg.note, 0, midi::clock::now()); });
+		},
+		[&](programChangeMessage& msg) {
+			g_midiChannelStates[msg.channel].write([&](channelState_t& state) { state.program = msg.program; });
+		}
+		});
+	if (g_midiOutContext) g_midiOutContext->sendMessage(message);
+}
+void poll_input() {
+	const size_t BATCH_SIZE = 256;
+	static std::array<midi::message_t, BATCH_SIZE> batch;
 	if (g_midiInContext) {
 		if (g_midiInContext->getStatus()) {
-			while (auto pool = g_midiInContext->pollMessage()) {
-				auto& message = pool.value();
-				bool passthrough = true;
-				std::visit(visitor{
-					[&](noteOnMessage& msg) {
-						if (!g_midiChannelStates[msg.channel].hold)
-							g_midiChannelStates[msg.channel].keys[msg.note] = msg.velocity;
-						else {
-							if (msg.velocity == 0) passthrough = false;
-							else g_midiChannelStates[msg.channel].keys[msg.note] = msg.velocity;
-						}
-						if (msg.channel == g_config.inputChannel)
-							map_midi_to_keystroke(msg.velocity, msg.note);
-						if (g_midiChannelStates[msg.channel].muted)
-							passthrough = false;
-					},
-					[&](noteOffMessage& msg) {
-						if (!g_midiChannelStates[msg.channel].hold)
-							g_midiChannelStates[msg.channel].keys[msg.note] = 0;
-						else
-							passthrough = false;
-						if (msg.channel == g_config.inputChannel)
-							map_midi_to_keystroke(0, msg.note);
-					},
-					[&](pitchBendMessage& msg) {
-						g_midiChannelStates[msg.channel].controls.pitchBend = msg.level;
-					},
-					[&](controlChangeMessage& msg) {
-						g_midiChannelStates[msg.channel].controls.cc[msg.controller] = msg.value;
-					},
-					[&](programChangeMessage& msg) {
-						g_midiChannelStates[msg.channel].program = msg.program;
-					}
-					}, message);
-				if (g_midiOutContext) {
-					std::visit(visitor{
-						[&](auto& msg) {
-							constexpr bool channel_type = requires() { msg.channel; };
-							if constexpr (channel_type) {
-								g_activeInputs[msg.channel] = ACTIVE_INPUT_FRAMES;
-								if (msg.channel == g_config.inputChannel && g_config.inputChannelRemap >= 0)
-									msg.channel = g_config.inputChannelRemap;
-							}
-						},
-						}, message);
-					if (passthrough) g_midiOutContext->sendMessage(message);
-				}
-			}
+			size_t count;
+			do {
+				count = g_midiInContext->pollMessages(batch);
+				for (size_t i = 0; i < count; i++)
+					route_message(batch[i]);
+			} while (count == BATCH_SIZE);
 		}
 	}
+	g_localMessages.consume(route_local_message);
+}
+void route_loop(std::stop_token stop) {
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+	while (!stop.stop_requested()) {
+		if (g_midiInContext && g_midiInContext->getStatus())
+			g_midiInContext->waitMessage(ROUTER_WAKE_INTERVAL, [] { return !g_localMessages.empty(); });
+		else
+			g_localMessages.wait_for(ROUTER_WAKE_INTERVAL);
+		poll_input();
+	}
 }
 void draw() {
 	ImGui::SetNextWindowPos({ 0,0 });
@@ -251,17 +399,20 @@ void draw() {
 		)) {
 			for (auto& [index, name, id] : g_midiInDevices) {
 				bool selected = g_midiInContext && g_midiInContext->getIndex() == index;
-				if (ImGui::Selectable(name.c_str(), &selected))
+				if (ImGui::Selectable(name.c_str(), &selected)) {
+					stop_router();
 					g_midiInContext = make_midi_input_context(g_midiInDevices[index]), g_config.inputDeviceIndex = index;
+					start_router();
+				}
 			}
 			ImGui::EndCombo();
 		}
 		auto width = ImGui::CalcItemWidth() / 3.0f;
-		ImGui::ProgressBar(g_midiChannelStates[g_config.inputChannel].controls.pitchBend / 8192.0f / 2.0f, ImVec2(width, 1), "PITCH");
+		ImGui::ProgressBar(g_channelSnapshots[g_config.inputChannel].controls.pitchBend / 8192.0f / 2.0f, ImVec2(width, 1), "PITCH");
 		ImGui::SameLine();
-		ImGui::ProgressBar(g_midiChannelStates[g_config.inputChannel].controls.cc[1] / 127.0f, ImVec2(width, 1), "MOD");
+		ImGui::ProgressBar(g_channelSnapshots[g_config.inputChannel].controls.cc[1] / 127.0f, ImVec2(width, 1), "MOD");
 		ImGui::SameLine();
-		ImGui::ProgressBar(g_midiChannelStates[g_config.inputChannel].controls.cc[64] / 127.0f, ImVec2(width, 1), "SUSTAIN");
+		ImGui::ProgressBar(g_channelSnapshots[g_config.inputChannel].controls.cc[64] / 127.0f, ImVec2(width, 1), "SUSTAIN");
 		draw_button_array(g_config.inputChannel, channel_names, 0, g_activeInputs.data());
 		ImGui::Text("Input Channel");
 		ImGui::SliderInt("Remap Channel", &g_config.inputChannelRemap, -1, 15);
@@ -277,16 +428,21 @@ void draw() {
 		)) {
 			for (auto& [index, name, id] : g_midiOutDevices) {
 				bool selected = g_midiOutContext && g_midiOutContext->getIndex() == index;
-				if (ImGui::Selectable(name.c_str(), &selected))
+				if (ImGui::Selectable(name.c_str(), &selected)) {
+					stop_router();
 					g_midiOutContext = make_midi_output_context(g_midiOutDevices[index]), g_config.outputDeviceIndex = index;
+					start_router();
+				}
 			}
 			ImGui::EndCombo();
 		}
+		ImGui::Text("Passthrough Latency: %.3f ms (avg %.3f ms, max %.3f ms)",
+			g_passthroughLatency.last.load() / 1e6, g_passthroughLatency.average.load() / 1e6, g_passthroughLatency.max.load() / 1e6);
 		if (g_midiOutContext) {
 			bool channel_changed = draw_button_array(g_config.outputChannel, channel_names, midi::MAX_CHANNEL_COUNT);
 			ImGui::Text("Output Channel");
 			{
-				auto& program = g_midiChannelStates[g_config.outputChannel].program;
+				int program = g_channelSnapshots[g_config.outputChannel].program;
 				bool program_changed = false;				
 				if (ImGui::BeginCombo("Program", midi::gm::programs[program])) {
 					for (int i = 0; i < extent_of(midi::gm::programs); i++) {
@@ -300,35 +456,34 @@ void draw() {
 				ImGui::SameLine();
 				program_changed |= draw_twiddle_button(program, 0, extent_of(midi::gm::programs), 32);
 				if (program_changed)
-					g_midiOutContext->sendMessage(midi::programChangeMessage{ (BYTE)g_config.outputChannel, (BYTE)program });				
+					send_local_message(midi::programChangeMessage{ (BYTE)g_config.outputChannel, (BYTE)program });				
 			}
 			ImGui::Text("Channel Settings");
 			{
-				auto& muted = g_midiChannelStates[g_config.outputChannel].muted;
-				auto& solo = g_midiChannelStates[g_config.outputChannel].solo;
-				auto& hold = g_midiChannelStates[g_config.outputChannel].hold;
+				auto& settings = g_channelSettings[g_config.outputChannel];
+				bool muted = settings.muted, solo = settings.solo, hold = settings.hold;
 				auto release_all_keys = [&](int channel) {
-					for (int i = 0; i < 128; i++) {
-						if (g_midiChannelStates[channel].keys[i] > 0) {
-							g_midiOutContext->sendMessage(midi::noteOffMessage{ (BYTE)channel, (BYTE)i, 0 });
-							g_midiChannelStates[channel].keys[i] = 0;
-						}
-					}
+					g_channelSnapshots[channel].keys.for_each([&](int note) {
+						send_local_message(midi::noteOffMessage{ (BYTE)channel, (BYTE)note, 0 });
+						});
 					};
 				auto set_channel_mute = [&](int channel, bool mute) {
-					g_midiChannelStates[channel].muted = mute;
+					g_channelSettings[channel].muted = mute;
 					if (mute) release_all_keys(channel);
 					};
-				ImGui::Checkbox("Mute", &muted); ImGui::SameLine();
+				if (ImGui::Checkbox("Mute", &muted)) settings.muted = muted;
+				ImGui::SameLine();
 				if (ImGui::Checkbox("Solo", &solo)) {
 					if (!solo) for (int i = 0; i < midi::MAX_CHANNEL_COUNT; i++) set_channel_mute(i, false);
 					else {
-						for (int i = 0; i < midi::MAX_CHANNEL_COUNT; i++) set_channel_mute(i, true), g_midiChannelStates[i].solo = false;
-						muted = false, solo = true;
+						for (int i = 0; i < midi::MAX_CHANNEL_COUNT; i++) set_channel_mute(i, true), g_channelSettings[i].solo = false;
+						settings.muted = false;
 					}
+					settings.solo = solo;
 				}
 				ImGui::SameLine();
 				if (ImGui::Checkbox("Hold", &hold)) {
+					settings.hold = hold;
 					if (!hold) release_all_keys(g_config.outputChannel);
 				}
 			}
@@ -372,9 +527,9 @@ void draw() {
 				if (isBlack && !isBlackKey) continue;
 				ImVec4 keyColor = isBlackKey ? blackKeyColor : whiteKeyColor;
 				ImVec4 labelColor = isBlackKey ? whiteKeyColor : blackKeyColor;
-				if (g_midiChannelStates[g_config.inputChannel].keys[note] > 0)
+				if (g_channelSnapshots[g_config.inputChannel].keys[note] > 0)
 				{
-					float t = g_midiChannelStates[g_config.inputChannel].keys[note] / 127.0f;
+					float t = g_channelSnapshots[g_config.inputChannel].keys[note] / 127.0f;
 					keyColor = ImLerp(pressedKeyColor, blackKeyColor, t);
 				}
 				ImVec2 keySize = isBlackKey ? blackKeySize : whiteKeySize;
@@ -450,20 +605,109 @@ void draw() {
 		}
 	}
 	if (ImGui::CollapsingHeader("Chords", ImGuiTreeNodeFlags_DefaultOpen)) {
-		g_chordNames.resize(chord::format(g_midiChannelStates[g_config.inputChannel].keys, g_chordNames.span_max()));
+		ImGui::Checkbox("All Channels", &g_config.chordAllChannels);
+		if (g_config.chordAllChannels) {
+			for (int i = 0; i < midi::MAX_CHANNEL_COUNT; i++) {
+				auto& name = g_channelChordNames[i];
+				if (name.size()) ImGui::Text("Ch %2d  %.*s", i + 1, (int)name.size(), name.data());
+			}
+			ImGui::Separator();
+		}
 		for (auto& line : g_chordNames) {
-			ImGui::TextUnformatted(line.data());
+			ImGui::TextUnformatted(line.data(), line.data() + line.size());
+		}
+		if (g_chordNamesOverflow) ImGui::Text("(+%zu more)", g_chordNamesOverflow);
+		if (ImGui::Checkbox("Smoothing", &g_config.chordSmoothing)) g_chordDecoder.reset();
+		if (g_config.chordSmoothing) {
+			char label[16];
+			smoothing::format_state(label, sizeof(label), g_chordDecoder.head());
+			ImGui::SameLine();
+			ImGui::Text("%s", label);
+		}
+		if (g_chordKey.key >= 0) ImGui::Text("Key: %s %s (r = %.2f)", chord::key_table[g_chordKey.tonic()], g_chordKey.mode(), g_chordKey.correlation);
+		if (ImGui::SliderInt("Arpeggio Window (ms)", &g_config.chordWindowMs, 0, 2000)) g_chordNamesSource.channel = -1;
+		// Held keys, or what the pedals keep sounding as well
+		if (ImGui::Checkbox("Pedals", &g_config.chordSounding)) g_chordNamesSource.channel = -1;
+		ImGui::Checkbox("Closest Chords", &g_config.chordClosest);
+		if (g_config.chordClosest) {
+			for (auto& match : g_chordClosest) {
+				auto name = chord::chord_name(match.chord, g_chordClosestBass);
+				ImGui::Text("%-24.*s -%d +%d", (int)name.size(), name.data(), match.missing, match.extra);
+			}
 		}
 	}
 	ImGui::End();
 }
+void refresh_chord_names(chord::midi_key_states_t const& keys, int source) {
+	auto key = chord::format_key(keys);
+	if (g_chordNamesSource.channel == source && g_chordNamesSource.key == key) return;
+	const size_t count = chord::names(chord::analyze(keys), g_chordNames.span_max());
+	g_chordNames.resize(std::min(count, chord::MAX_NAME_COUNT));
+	g_chordNamesOverflow = count - g_chordNames.size();
+	// Ranking a lone note or nothing is meaningless
+	g_chordClosest.resize(key.count > 1 && (key.intervals & chord::LOOKUP_MASK) ? chord::fuzzy_find(key.intervals, g_chordClosest.span_max()) : 0);
+	g_chordClosestBass = key.bass;
+	if (g_config.chordSmoothing) {
+		if (g_chordNamesSource.channel != source) g_chordDecoder.reset();
+		g_chordDecoder.step(keys.pitch_classes());
+	}
+	g_chordNamesSource = { source, key };
+}
 void refresh() {
-	for (auto& frame : g_activeInputs) frame--, frame = std::max(0, frame);
+	uint64_t now = midi::clock::now();
+	const uint64_t window = chord_window();
+	std::array<bool, midi::MAX_CHANNEL_COUNT> changed;
+	for (size_t i = 0; i < midi::MAX_CHANNEL_COUNT; i++) {
+		changed[i] = g_midiChannelStates[i].read_if_changed(g_channelSnapshots[i], g_channelSnapshotVersions[i]);
+		// Onsets run out of the window without any new message
+		if (window) changed[i] |= g_channelSnapshots[i].onsets.expire(now, window);
+	}
+	if (!g_config.chordAllChannels) {
+		const int channel = g_config.inputChannel;
+		if (g_chordNamesSource.channel != channel || changed[channel]) {
+			refresh_chord_names(chord_keys(g_channelSnapshots[channel]), channel);
+			g_chordKey = tonality::estimate(g_channelSnapshots[channel].pitches, now);
+		}
+	}
+	else {
+		// Each analysis is a few table loads, far cheaper than handing it to another thread
+		const bool all = g_chordNamesSource.channel != CHORD_SOURCE_ALL_CHANNELS;
+		bool any = all;
+		for (size_t i = 0; i < midi::MAX_CHANNEL_COUNT; i++) {
+			if (!all && !changed[i]) continue;
+			g_channelChordNames[i] = {};
+			chord::names(chord::analyze(chord_keys(g_channelSnapshots[i])), { &g_channelChordNames[i], 1 });
+			any = true;
+		}
+		if (any) {
+			chord::midi_key_states_t merged{};
+			std::array<float, 12> pitches{};
+			for (auto& snapshot : g_channelSnapshots) merged.merge(chord_keys(snapshot)), snapshot.pitches.accumulate(pitches, now);
+			refresh_chord_names(merged, CHORD_SOURCE_ALL_CHANNELS);
+			g_chordKey = tonality::estimate(pitches);
+		}
+	}
+	for (size_t i = 0; i < midi::MAX_CHANNEL_COUNT; i++)
+		g_activeInputs[i] = now - g_lastChannelInput[i].load(std::memory_order_relaxed) < ACTIVE_INPUT_DURATION;
 }
 void cleanup() {
+	stop_router();
 	if (g_midiInContext) g_midiInContext.reset();
 }
-int main() {
+int main(int argc, char** argv) {
+	if (argc > 2 && !strcmp(argv[1], "--dump-dictionary")) {
+		// Built-in tables in the file format, to be edited and loaded back as DICTIONARY_FILENAME
+		auto image = chord::dictionary_t::serialize_builtin();
+		FILE* file = fopen(argv[2], "wb");
+		ASSERT(file, L"Failed to open file for writing");
+		fwrite(image.data(), 1, image.size(), file);
+		fclose(file);
+		return 0;
+	}
+	if (std::filesystem::exists(DICTIONARY_FILENAME) && !chord::load_dictionary(DICTIONARY_FILENAME))
+		fprintf(stderr, "Invalid " DICTIONARY_FILENAME " file, using the built-in chords\n");
+	if (argc > 1 && !strcmp(argv[1], "--analyze"))
+		return analysis::run(argc - 2, argv + 2);
 #ifdef WINRT
 	winrt::init_apartment();
 #ifdef MIDI2
@@ -479,6 +723,7 @@ int main() {
 	ImTui_ImplText_Init();
 	ImGui::GetStyle().ScrollbarSize = 1;
 	ImGui::GetStyle().GrabMinSize = 1.0f;
+	chord::name_table(); // Built up front instead of on the first chord
 	g_config.load();
 	setup();
 	while (true) {
@@ -486,8 +731,9 @@ int main() {
 		ImTui_ImplText_NewFrame();
 		ImGui::NewFrame();
 		refresh();
-		poll_input();
 		draw();
+		g_routerConfig.publish();
+		flush_local_messages();
 		ImGui::Render();
 		ImTui_ImplText_RenderDrawData(ImGui::GetDrawData(), screen);
 		ImTui_ImplNcurses_DrawScreen();
@@ -498,10 +744,8 @@ int main() {
 #else
 	g_config.load();
 	setup();
-	while (true) {
-		refresh();
-		poll_input();
-	}
+	// The router sleeps on input readiness by itself, nothing else to do here
+	g_router.join();
 	cleanup();
 #endif // ENABLE_UI
 
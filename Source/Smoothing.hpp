@@ -0,0 +1,97 @@
+#pragma once
+#include "pch.hpp"
+#include "Chord.hpp"
+// Chord label smoothing. A hidden Markov model over triad and seventh chord states, decoded with
+// fixed-lag Viterbi: each observed pitch class set costs the same bounded work, and only the last LAG
+// steps of backpointers are kept. Partial chords played note by note then stay on one label.
+namespace smoothing {
+	using namespace std;
+	using chord::pitch_class_mask_t;
+	// Root major, minor, dominant 7th, diminished
+	constexpr pitch_class_mask_t quality_masks[] = { 0x091, 0x089, 0x491, 0x049 };
+	const char* quality_table[] = { "", "m", "7", "dim" };
+	constexpr size_t QUALITY_COUNT = extent_of(quality_masks);
+	// State s < NO_CHORD is quality s / 12 on root s % 12. No chord has an empty template.
+	constexpr size_t NO_CHORD = QUALITY_COUNT * 12, STATE_COUNT = NO_CHORD + 1;
+	// Emission costs (-log probability) per template tone not held, and per held tone outside the template
+	constexpr float MISSING_COST = 1.0f, EXTRA_COST = 2.5f;
+	// Chance of keeping the label on the next change. The rest is spread evenly over the other states.
+	constexpr float STAY_PROBABILITY = 0.5f;
+	constexpr size_t LAG = 8;
+	// Log probabilities are fixed point, so the inner maximization is an integer max that vectorizes.
+	// The low 6 bits carry the predecessor, inverted so ties go to the lower state as before.
+	constexpr int32_t SCORE_SCALE = 64; // Steps per nat
+	constexpr int32_t SCORE_FLOOR = -(1 << 20); // Far below anything reachable, keeps the packing in range
+	constexpr int32_t INDEX_BITS = 6;
+	static_assert(STATE_COUNT <= 1 << INDEX_BITS);
+	constexpr int32_t to_score(float log_probability) { return int32_t(log_probability * SCORE_SCALE - 0.5f); }
+	/****/
+	struct model_t {
+		array<pitch_class_mask_t, STATE_COUNT> masks{};
+		// [to * STATE_COUNT + from] so the maximization runs over a contiguous row
+		alignas(64) array<int32_t, STATE_COUNT * STATE_COUNT> transitions;
+		inline model_t() {
+			for (size_t quality = 0; quality < QUALITY_COUNT; quality++)
+				for (int root = 0; root < 12; root++)
+					masks[quality * 12 + root] = chord::rotate_pitch_classes(quality_masks[quality], 12 - root);
+			const int32_t stay = to_score(log(STAY_PROBABILITY)), move = to_score(log((1 - STAY_PROBABILITY) / (STATE_COUNT - 1)));
+			for (size_t to = 0; to < STATE_COUNT; to++)
+				for (size_t from = 0; from < STATE_COUNT; from++)
+					transitions[to * STATE_COUNT + from] = to == from ? stay : move;
+		}
+	};
+	inline model_t const& model() {
+		static const model_t model;
+		return model;
+	}
+	inline int format_state(char* str, size_t size, uint8_t state) {
+		if (state >= NO_CHORD) return snprintf(str, size, "N.C.");
+		return snprintf(str, size, "%s%s", chord::key_table[state % 12], quality_table[state / 12]);
+	}
+	/****/
+	class decoder_t {
+		array<int32_t, STATE_COUNT> _score{}; // Best path log probability into each state, shifted so the best is 0
+		array<array<uint8_t, STATE_COUNT>, LAG> _back{}; // Ring of backpointers, one column per step
+		size_t _steps = 0;
+		uint8_t _head = NO_CHORD;
+	public:
+		inline void reset() { *this = {}; }
+		// Last state of the best path so far
+		inline uint8_t head() const { return _head; }
+		// Advances by one observation. Returns the state LAG - 1 steps back, which no later observation can
+		// change any more, or -1 while the window is still filling.
+		inline int step(pitch_class_mask_t pitch_classes) {
+			auto const& m = model();
+			auto& back = _back[_steps % LAG];
+			constexpr int32_t missing_cost = to_score(-MISSING_COST), extra_cost = to_score(-EXTRA_COST);
+			array<int32_t, STATE_COUNT> score;
+			int32_t best = INT32_MIN;
+			for (size_t to = 0; to < STATE_COUNT; to++) {
+				const int32_t* row = m.transitions.data() + to * STATE_COUNT;
+				int32_t packed = INT32_MIN;
+				for (int32_t i = 0; i < (int32_t)STATE_COUNT; i++)
+					packed = max(packed, (_score[i] + row[i]) * (1 << INDEX_BITS) | ((1 << INDEX_BITS) - 1 - i));
+				back[to] = uint8_t((1 << INDEX_BITS) - 1 - (packed & ((1 << INDEX_BITS) - 1)));
+				score[to] = (packed >> INDEX_BITS)
+					+ missing_cost * chord::popcount_swar(m.masks[to] & ~pitch_classes)
+					+ extra_cost * chord::popcount_swar(pitch_classes & ~m.masks[to]);
+				if (score[to] > best) best = score[to], _head = (uint8_t)to;
+			}
+			for (size_t i = 0; i < STATE_COUNT; i++) _score[i] = max(score[i] - best, SCORE_FLOOR);
+			if (++_steps < LAG) return -1;
+			array<uint8_t, LAG> path;
+			window(path);
+			return path[0];
+		}
+		// Best path through the steps still in the window, oldest first. Returns its length.
+		inline size_t window(span<uint8_t, LAG> out) const {
+			const size_t count = min(_steps, LAG);
+			uint8_t state = _head;
+			for (size_t i = 1; i <= count; i++) {
+				out[count - i] = state;
+				state = _back[(_steps - i) % LAG][state];
+			}
+			return count;
+		}
+	};
+}
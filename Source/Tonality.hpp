@@ -0,0 +1,97 @@
+#pragma once
+#include "pch.hpp"
+#include "Chord.hpp"
+// Running key estimate. Sounding time per pitch class decays exponentially and is correlated
+// against the Krumhansl-Kessler major and minor profiles of all 24 keys.
+namespace tonality {
+	using namespace std;
+	constexpr size_t KEY_COUNT = 24; // C major..B major, then C minor..B minor
+	// Probe tone ratings, tonic first
+	constexpr float MAJOR_PROFILE[12] = { 6.35f, 2.23f, 3.48f, 2.33f, 4.38f, 4.09f, 2.52f, 5.19f, 2.39f, 3.66f, 2.29f, 2.88f };
+	constexpr float MINOR_PROFILE[12] = { 6.33f, 2.68f, 3.52f, 5.38f, 2.60f, 3.53f, 2.54f, 4.75f, 3.98f, 2.69f, 3.34f, 3.17f };
+	const char* mode_table[] = { "major", "minor" };
+	// Time constant of the decay. Notes older than a few of these barely count.
+	constexpr double DECAY_SECONDS = 4.0;
+	/****/
+	// Decaying duration-weighted pitch class histogram. O(1) per note event:
+	// weights are kept scaled by exp((t - origin) / DECAY_SECONDS), so a sounding note's ever growing share
+	// is closed form and nothing is touched between events. Time is in midi::clock nanoseconds.
+	class histogram_t {
+		array<double, 12> _weight{}; // Scaled sounding time, less the scaled onsets of notes still sounding
+		array<uint8_t, 12> _sounding{};
+		uint64_t _origin = 0;
+		static constexpr double REBASE_AFTER = 64.0; // Decay constants, well within double range
+		inline double scale(uint64_t time) const { return exp((int64_t)(time - _origin) * 1e-9 / DECAY_SECONDS); }
+	public:
+		// Called on every note on -> off and off -> on transition, in time order
+		inline void note(uint8_t note, bool on, uint64_t time) {
+			if ((int64_t)(time - _origin) * 1e-9 / DECAY_SECONDS > REBASE_AFTER) {
+				// Rare, and the only pass over every pitch class
+				const double factor = 1.0 / scale(time);
+				for (auto& weight : _weight) weight *= factor;
+				_origin = time;
+			}
+			const int pc = note % 12;
+			if (!on && !_sounding[pc]) return;
+			_weight[pc] += (on ? -DECAY_SECONDS : DECAY_SECONDS) * scale(time);
+			_sounding[pc] += on ? 1 : -1;
+		}
+		// Adds the decayed sounding seconds per pitch class at time to out
+		inline void accumulate(span<float, 12> out, uint64_t time) const {
+			const double factor = 1.0 / scale(time);
+			for (int i = 0; i < 12; i++)
+				out[i] += (float)max(0.0, _weight[i] * factor + _sounding[i] * DECAY_SECONDS);
+		}
+	};
+	/****/
+	// Profiles rotated to every key, mean removed and normalized. Stored key-minor so the 24 scores
+	// are one multiply-add over a contiguous row per pitch class, which vectorizes.
+	struct profile_matrix_t {
+		alignas(64) array<array<float, KEY_COUNT>, 12> weights;
+		inline profile_matrix_t() {
+			auto fill = [&](const float(&profile)[12], size_t first) {
+				float mean = 0, norm = 0;
+				for (float value : profile) mean += value / 12;
+				for (float value : profile) norm += (value - mean) * (value - mean);
+				norm = sqrt(norm);
+				for (size_t tonic = 0; tonic < 12; tonic++)
+					for (size_t pc = 0; pc < 12; pc++)
+						weights[pc][first + tonic] = (profile[(pc + 12 - tonic) % 12] - mean) / norm;
+				};
+			fill(MAJOR_PROFILE, 0);
+			fill(MINOR_PROFILE, 12);
+		}
+	};
+	inline profile_matrix_t const& profile_matrix() {
+		static const profile_matrix_t matrix;
+		return matrix;
+	}
+	struct estimate_t {
+		int8_t key = -1; // Index into the 24 keys, -1 if nothing has sounded
+		float correlation = 0; // Pearson r against the key's profile
+		inline int tonic() const { return key % 12; }
+		inline const char* mode() const { return mode_table[key / 12]; }
+	};
+	// Best correlated key of a histogram
+	inline estimate_t estimate(span<const float, 12> histogram) {
+		// The profiles are zero mean, so the histogram mean drops out of the dot products
+		auto const& matrix = profile_matrix().weights;
+		alignas(64) array<float, KEY_COUNT> scores{};
+		float sum = 0, squares = 0;
+		for (size_t pc = 0; pc < 12; pc++) {
+			const float value = histogram[pc];
+			const float* row = matrix[pc].data();
+			for (size_t key = 0; key < KEY_COUNT; key++) scores[key] += value * row[key];
+			sum += value, squares += value * value;
+		}
+		const float norm = squares - sum * sum / 12;
+		if (norm <= 1e-12f * squares || squares == 0) return {};
+		const size_t best = max_element(scores.begin(), scores.end()) - scores.begin();
+		return { (int8_t)best, scores[best] / sqrt(norm) };
+	}
+	inline estimate_t estimate(histogram_t const& histogram, uint64_t time) {
+		array<float, 12> values{};
+		histogram.accumulate(values, time);
+		return estimate(values);
+	}
+}
@@ -2,10 +2,16 @@
 #ifdef __cplusplus
 #include <array>
 #include <algorithm>
+#include <bit>
+#include <cmath>
 #include <vector>
 #include <queue>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
+#include <semaphore>
+#include <thread>
+#include <chrono>
 #include <optional>
 #ifndef WIN32_LEAN_AND_MEAN
 #define WIN32_LEAN_AND_MEAN
@@ -19,6 +25,8 @@
 #include <source_location>
 #include <string>
 #include <variant>
+#include <utility>
+#include <filesystem>
 
 #ifdef WINRT
 #pragma comment(lib, "windowsapp")
@@ -83,6 +91,174 @@ public:
 	inline size_t size() { return _size; }
 	inline void resize(size_t size) { ASSERT(size <= Size); _size = size; }
 };
+// Bounded single-producer/single-consumer ring buffer
+// push/pop are wait-free; indices live on separate cache lines and each side caches the other's index
+// wait() only sleeps (on a semaphore) when the ring is observed empty, the producer never blocks
+constexpr size_t CACHE_LINE_SIZE = 64;
+template<typename T, size_t Size> class spsc_ring {
+	static_assert(Size && (Size & (Size - 1)) == 0, "Size must be a power of two");
+	static constexpr size_t MASK = Size - 1;
+	// Consumer
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> _head{ 0 };
+	size_t _tail_cache{ 0 };
+	// Producer
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> _tail{ 0 };
+	size_t _head_cache{ 0 };
+	// Wakeup
+	alignas(CACHE_LINE_SIZE) std::atomic<bool> _waiting{ false };
+	std::counting_semaphore<> _signal{ 0 };
+	alignas(CACHE_LINE_SIZE) std::array<T, Size> _data{};
+public:
+	/* Producer */
+	inline bool push(T value) {
+		const size_t tail = _tail.load(std::memory_order_relaxed);
+		if (tail - _head_cache == Size) {
+			_head_cache = _head.load(std::memory_order_acquire);
+			if (tail - _head_cache == Size) return false;
+		}
+		_data[tail & MASK] = std::move(value);
+		_tail.store(tail + 1, std::memory_order_release);
+		notify();
+		return true;
+	}
+	// Wakes a waiting consumer. Also for work it waits on through ready, call after publishing that work.
+	inline void notify() {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (_waiting.load(std::memory_order_relaxed) && _waiting.exchange(false))
+			_signal.release();
+	}
+	/* Consumer */
+	inline bool pop(T& value) {
+		const size_t head = _head.load(std::memory_order_relaxed);
+		if (head == _tail_cache) {
+			_tail_cache = _tail.load(std::memory_order_acquire);
+			if (head == _tail_cache) return false;
+		}
+		value = std::move(_data[head & MASK]);
+		_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+	// Moves up to out.size() elements out with a single acquire of the producer's index
+	inline size_t pop(std::span<T> out) {
+		const size_t head = _head.load(std::memory_order_relaxed);
+		if (out.size() > _tail_cache - head)
+			_tail_cache = _tail.load(std::memory_order_acquire);
+		const size_t count = std::min(out.size(), _tail_cache - head);
+		for (size_t i = 0; i < count; i++)
+			out[i] = std::move(_data[(head + i) & MASK]);
+		_head.store(head + count, std::memory_order_release);
+		return count;
+	}
+	// Calls func(T&) on every element available at the time of the call
+	template<typename Func> inline size_t consume(Func&& func) {
+		const size_t head = _head.load(std::memory_order_relaxed);
+		_tail_cache = _tail.load(std::memory_order_acquire);
+		const size_t count = _tail_cache - head;
+		for (size_t i = 0; i < count; i++)
+			func(_data[(head + i) & MASK]);
+		_head.store(head + count, std::memory_order_release);
+		return count;
+	}
+	inline bool empty() const {
+		return _head.load(std::memory_order_relaxed) == _tail.load(std::memory_order_acquire);
+	}
+	inline void wait() {
+		while (empty()) {
+			_waiting.store(true, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (!empty()) { _waiting.store(false, std::memory_order_relaxed); break; }
+			_signal.acquire();
+		}
+	}
+	// Returns false if the ring is still empty and ready() still false once timeout has elapsed.
+	// Whoever makes ready() true must notify() afterwards.
+	template<typename Rep, typename Period, typename Ready = bool(*)()>
+	inline bool wait_for(std::chrono::duration<Rep, Period> const& timeout, Ready&& ready = [] { return false; }) {
+		const auto deadline = std::chrono::steady_clock::now() + timeout;
+		auto idle = [&] { return empty() && !ready(); };
+		while (idle()) {
+			_waiting.store(true, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (!idle()) { _waiting.store(false, std::memory_order_relaxed); break; }
+			if (!_signal.try_acquire_until(deadline)) {
+				_waiting.store(false, std::memory_order_relaxed);
+				return !idle();
+			}
+		}
+		return true;
+	}
+	inline constexpr size_t capacity() const { return Size; }
+};
+// Single-writer sequence lock. The writer never blocks, readers retry a copy that raced a write.
+// The sequence number doubles as a version: it is even and changes with every write.
+template<typename T> class seqlock {
+	static_assert(std::is_trivially_copyable_v<T>);
+	alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> _seq{ 0 };
+	T _data{};
+public:
+	/* Writer */
+	// The writer's own view, no synchronization needed
+	inline T const& get() const { return _data; }
+	template<typename Func> inline void write(Func&& func) {
+		const uint32_t seq = _seq.load(std::memory_order_relaxed);
+		_seq.store(seq + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		func(_data);
+		_seq.store(seq + 2, std::memory_order_release);
+	}
+	/* Readers */
+	inline uint32_t version() const { return _seq.load(std::memory_order_acquire); }
+	// Copies a consistent snapshot into out, returns its version
+	inline uint32_t read(T& out) const {
+		uint32_t before, after;
+		do {
+			before = _seq.load(std::memory_order_acquire);
+			if (before & 1) { std::this_thread::yield(); continue; }
+			memcpy(&out, &_data, sizeof(T));
+			std::atomic_thread_fence(std::memory_order_acquire);
+			after = _seq.load(std::memory_order_relaxed);
+		} while ((before & 1) || before != after);
+		return before;
+	}
+	// Same as read() but skips the copy if nothing was written since version. Returns whether out was updated.
+	inline bool read_if_changed(T& out, uint32_t& version) const {
+		if (_seq.load(std::memory_order_acquire) == version) return false;
+		version = read(out);
+		return true;
+	}
+};
+// Read-only memory mapped file. Empty if it could not be opened or has no contents.
+class mapped_file {
+	const char* _data = nullptr;
+	size_t _size = 0;
+public:
+	inline mapped_file() = default;
+	inline explicit mapped_file(std::filesystem::path const& path) {
+		HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE) return;
+		LARGE_INTEGER size{};
+		if (GetFileSizeEx(file, &size) && size.QuadPart) {
+			if (HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL)) {
+				_data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+				if (_data) _size = size.QuadPart;
+				CloseHandle(mapping); // The view keeps the mapping alive
+			}
+		}
+		CloseHandle(file);
+	}
+	inline mapped_file(mapped_file&& other) noexcept : _data(std::exchange(other._data, nullptr)), _size(std::exchange(other._size, 0)) {}
+	inline mapped_file& operator=(mapped_file&& other) noexcept {
+		std::swap(_data, other._data), std::swap(_size, other._size);
+		return *this;
+	}
+	mapped_file(mapped_file const&) = delete;
+	inline ~mapped_file() { if (_data) UnmapViewOfFile(_data); }
+
+	inline const char* data() const { return _data; }
+	inline size_t size() const { return _size; }
+	inline bool empty() const { return !_size; }
+	inline std::span<const char> span() const { return { _data, _size }; }
+};
 // Column major matrix
 template<typename T, size_t Rows, size_t Cols> class fixed_matrix {
 	using column_type = fixed_vector<T, Cols>;